@@ -0,0 +1,809 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Desktop-like workloads against a trigger5 DRM node, to compare changes to
+ * the update path against a baseline:
+ *
+ *   ./tools/trigger5_bench                  all scenarios, 5 s each
+ *   ./tools/trigger5_bench -s typing,cursor -t 10 -c > after.csv
+ *
+ * Every scenario renders into dumb buffers and reports the frame rate it
+ * achieved, percentiles of the time each update took to be accepted and
+ * the bytes per frame it damaged, at the driver's wire depth. Regions a
+ * cursor move resends are counted apart from the primary plane's damage.
+ * Run as root with debugfs mounted, it also reads the wire depth from the
+ * driver and reports the bytes it actually put on the wire per frame.
+ *
+ * The driver only takes a snapshot of an update in the commit, but a commit
+ * first waits for the flip before it, which completes once that frame is on
+ * the wire. Back to back flips therefore measure the full update latency.
+ * DIRTYFB only waits for the update to be queued.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <drm_fourcc.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#define CURSOR_SIZE	64
+#define MAX_CLIPS	16
+
+struct buffer {
+	uint32_t handle;
+	uint32_t fb_id;
+	uint32_t pitch;
+	uint32_t width;
+	uint32_t height;
+	uint64_t size;
+	uint32_t *map;
+};
+
+struct props {
+	uint32_t fb_id, crtc_id, src_x, src_y, src_w, src_h;
+	uint32_t crtc_x, crtc_y, crtc_w, crtc_h, damage_clips;
+};
+
+struct bench {
+	int fd;
+	unsigned int minor;
+	drmModeModeInfo mode;
+	uint32_t connector_id, crtc_id, primary_id, cursor_id;
+	uint32_t conn_crtc_prop, crtc_mode_prop, crtc_active_prop;
+	struct props primary, cursor;
+	struct buffer fb[2], cursor_fb;
+	unsigned int front;
+	unsigned int fps;
+	double duration;
+	// Bytes per pixel on the wire, 3 unless the driver reports otherwise
+	unsigned int wire_cpp;
+
+	// Results of the running scenario
+	uint64_t *latency;
+	unsigned int frames, max_frames;
+	uint64_t damage_bytes;
+	uint64_t cursor_bytes;
+};
+
+struct scenario {
+	const char *name;
+	void (*run)(struct bench *bench);
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(EXIT_FAILURE);
+}
+
+static uint32_t find_prop(int fd, uint32_t obj, uint32_t type,
+			  const char *name)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	uint32_t id = 0;
+	unsigned int i;
+
+	props = drmModeObjectGetProperties(fd, obj, type);
+	if (!props)
+		return 0;
+	for (i = 0; i < props->count_props && !id; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (prop && !strcmp(prop->name, name))
+			id = prop->prop_id;
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+	return id;
+}
+
+static uint64_t prop_value(int fd, uint32_t obj, uint32_t type,
+			   const char *name)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	uint64_t value = 0;
+	unsigned int i;
+
+	props = drmModeObjectGetProperties(fd, obj, type);
+	if (!props)
+		return 0;
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (prop && !strcmp(prop->name, name))
+			value = props->prop_values[i];
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+	return value;
+}
+
+static void plane_props(int fd, uint32_t plane, struct props *p)
+{
+	uint32_t type = DRM_MODE_OBJECT_PLANE;
+
+	p->fb_id = find_prop(fd, plane, type, "FB_ID");
+	p->crtc_id = find_prop(fd, plane, type, "CRTC_ID");
+	p->src_x = find_prop(fd, plane, type, "SRC_X");
+	p->src_y = find_prop(fd, plane, type, "SRC_Y");
+	p->src_w = find_prop(fd, plane, type, "SRC_W");
+	p->src_h = find_prop(fd, plane, type, "SRC_H");
+	p->crtc_x = find_prop(fd, plane, type, "CRTC_X");
+	p->crtc_y = find_prop(fd, plane, type, "CRTC_Y");
+	p->crtc_w = find_prop(fd, plane, type, "CRTC_W");
+	p->crtc_h = find_prop(fd, plane, type, "CRTC_H");
+	p->damage_clips = find_prop(fd, plane, type, "FB_DAMAGE_CLIPS");
+}
+
+static void create_buffer(int fd, struct buffer *buf, uint32_t width,
+			  uint32_t height, uint32_t format)
+{
+	struct drm_mode_create_dumb create = {
+		.width = width,
+		.height = height,
+		.bpp = 32,
+	};
+	struct drm_mode_map_dumb map = { 0 };
+	uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create))
+		die("create dumb");
+	buf->handle = create.handle;
+	buf->pitch = create.pitch;
+	buf->size = create.size;
+	buf->width = width;
+	buf->height = height;
+
+	handles[0] = buf->handle;
+	pitches[0] = buf->pitch;
+	if (drmModeAddFB2(fd, width, height, format, handles, pitches, offsets,
+			  &buf->fb_id, 0))
+		die("add fb");
+
+	map.handle = buf->handle;
+	if (drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map))
+		die("map dumb");
+	buf->map = mmap(NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, map.offset);
+	if (buf->map == MAP_FAILED)
+		die("mmap");
+	memset(buf->map, 0, buf->size);
+}
+
+static void destroy_buffer(int fd, struct buffer *buf)
+{
+	struct drm_mode_destroy_dumb destroy = { .handle = buf->handle };
+
+	munmap(buf->map, buf->size);
+	drmModeRmFB(fd, buf->fb_id);
+	drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+}
+
+static int open_trigger5(const char *path)
+{
+	drmVersion *version;
+	char name[32];
+	int fd, i;
+
+	if (path)
+		return open(path, O_RDWR | O_CLOEXEC);
+
+	for (i = 0; i < 16; i++) {
+		snprintf(name, sizeof(name), "/dev/dri/card%d", i);
+		fd = open(name, O_RDWR | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		version = drmGetVersion(fd);
+		if (version && !strcmp(version->name, "trigger5")) {
+			drmFreeVersion(version);
+			return fd;
+		}
+		drmFreeVersion(version);
+		close(fd);
+	}
+	errno = ENODEV;
+	return -1;
+}
+
+// Pick the first connected connector, its preferred mode and its planes
+static void setup(struct bench *bench)
+{
+	int fd = bench->fd;
+	drmModeRes *res;
+	drmModeConnector *conn = NULL;
+	drmModePlaneRes *planes;
+	drmModePlane *plane;
+	unsigned int crtc_index = 0;
+	uint64_t type;
+	struct stat st;
+	int i;
+
+	if (drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) ||
+	    drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1))
+		die("atomic not supported");
+
+	res = drmModeGetResources(fd);
+	if (!res)
+		die("resources");
+	for (i = 0; i < res->count_connectors; i++) {
+		conn = drmModeGetConnector(fd, res->connectors[i]);
+		if (conn && conn->connection == DRM_MODE_CONNECTED &&
+		    conn->count_modes)
+			break;
+		drmModeFreeConnector(conn);
+		conn = NULL;
+	}
+	if (!conn || !res->count_crtcs) {
+		fprintf(stderr, "no connected monitor\n");
+		exit(EXIT_FAILURE);
+	}
+
+	bench->connector_id = conn->connector_id;
+	bench->mode = conn->modes[0];
+	for (i = 0; i < conn->count_modes; i++) {
+		if (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+			bench->mode = conn->modes[i];
+			break;
+		}
+	}
+	drmModeFreeConnector(conn);
+	bench->crtc_id = res->crtcs[crtc_index];
+	drmModeFreeResources(res);
+
+	planes = drmModeGetPlaneResources(fd);
+	if (!planes)
+		die("planes");
+	for (i = 0; i < (int)planes->count_planes; i++) {
+		plane = drmModeGetPlane(fd, planes->planes[i]);
+		if (!plane)
+			continue;
+		if (plane->possible_crtcs & (1 << crtc_index)) {
+			type = prop_value(fd, plane->plane_id,
+					  DRM_MODE_OBJECT_PLANE, "type");
+			if (type == DRM_PLANE_TYPE_PRIMARY && !bench->primary_id)
+				bench->primary_id = plane->plane_id;
+			if (type == DRM_PLANE_TYPE_CURSOR && !bench->cursor_id)
+				bench->cursor_id = plane->plane_id;
+		}
+		drmModeFreePlane(plane);
+	}
+	drmModeFreePlaneResources(planes);
+	if (!bench->primary_id) {
+		fprintf(stderr, "no primary plane\n");
+		exit(EXIT_FAILURE);
+	}
+
+	plane_props(fd, bench->primary_id, &bench->primary);
+	if (bench->cursor_id)
+		plane_props(fd, bench->cursor_id, &bench->cursor);
+	bench->conn_crtc_prop = find_prop(fd, bench->connector_id,
+					  DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+	bench->crtc_mode_prop = find_prop(fd, bench->crtc_id,
+					  DRM_MODE_OBJECT_CRTC, "MODE_ID");
+	bench->crtc_active_prop = find_prop(fd, bench->crtc_id,
+					    DRM_MODE_OBJECT_CRTC, "ACTIVE");
+
+	if (!fstat(fd, &st))
+		bench->minor = minor(st.st_rdev);
+
+	for (i = 0; i < 2; i++)
+		create_buffer(fd, &bench->fb[i], bench->mode.hdisplay,
+			      bench->mode.vdisplay, DRM_FORMAT_XRGB8888);
+	if (bench->cursor_id)
+		create_buffer(fd, &bench->cursor_fb, CURSOR_SIZE, CURSOR_SIZE,
+			      DRM_FORMAT_ARGB8888);
+}
+
+static void add_plane(drmModeAtomicReq *req, uint32_t plane,
+		      const struct props *p, const struct buffer *buf,
+		      uint32_t crtc, int x, int y)
+{
+	drmModeAtomicAddProperty(req, plane, p->fb_id, buf->fb_id);
+	drmModeAtomicAddProperty(req, plane, p->crtc_id, crtc);
+	drmModeAtomicAddProperty(req, plane, p->src_x, 0);
+	drmModeAtomicAddProperty(req, plane, p->src_y, 0);
+	drmModeAtomicAddProperty(req, plane, p->src_w,
+				 (uint64_t)buf->width << 16);
+	drmModeAtomicAddProperty(req, plane, p->src_h,
+				 (uint64_t)buf->height << 16);
+	drmModeAtomicAddProperty(req, plane, p->crtc_x, x);
+	drmModeAtomicAddProperty(req, plane, p->crtc_y, y);
+	drmModeAtomicAddProperty(req, plane, p->crtc_w, buf->width);
+	drmModeAtomicAddProperty(req, plane, p->crtc_h, buf->height);
+}
+
+static void modeset(struct bench *bench)
+{
+	drmModeAtomicReq *req = drmModeAtomicAlloc();
+	uint32_t blob;
+
+	if (drmModeCreatePropertyBlob(bench->fd, &bench->mode,
+				      sizeof(bench->mode), &blob))
+		die("mode blob");
+
+	drmModeAtomicAddProperty(req, bench->connector_id,
+				 bench->conn_crtc_prop, bench->crtc_id);
+	drmModeAtomicAddProperty(req, bench->crtc_id, bench->crtc_mode_prop,
+				 blob);
+	drmModeAtomicAddProperty(req, bench->crtc_id, bench->crtc_active_prop,
+				 1);
+	add_plane(req, bench->primary_id, &bench->primary,
+		  &bench->fb[bench->front], bench->crtc_id, 0, 0);
+	if (drmModeAtomicCommit(bench->fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET,
+				NULL))
+		die("modeset");
+	drmModeAtomicFree(req);
+	drmModeDestroyPropertyBlob(bench->fd, blob);
+}
+
+/*
+ * Note the time an update took and the bytes it resends. Cursor moves go
+ * into cursor_bytes, clipped to the screen as the driver clips them.
+ */
+static void record(struct bench *bench, uint64_t start,
+		   const struct drm_mode_rect *clips, unsigned int num_clips,
+		   bool cursor)
+{
+	uint64_t *bytes = cursor ? &bench->cursor_bytes : &bench->damage_bytes;
+	int x1, y1, x2, y2;
+	unsigned int i;
+
+	if (bench->frames == bench->max_frames) {
+		bench->max_frames = bench->max_frames * 2 + 1024;
+		bench->latency = realloc(bench->latency,
+					 bench->max_frames * sizeof(uint64_t));
+		if (!bench->latency)
+			die("latency buffer");
+	}
+	bench->latency[bench->frames++] = now_ns() - start;
+
+	for (i = 0; i < num_clips; i++) {
+		x1 = clips[i].x1 > 0 ? clips[i].x1 : 0;
+		y1 = clips[i].y1 > 0 ? clips[i].y1 : 0;
+		x2 = clips[i].x2 < bench->mode.hdisplay ? clips[i].x2 :
+							  bench->mode.hdisplay;
+		y2 = clips[i].y2 < bench->mode.vdisplay ? clips[i].y2 :
+							  bench->mode.vdisplay;
+		if (x2 > x1 && y2 > y1)
+			*bytes += (uint64_t)(x2 - x1) * (y2 - y1) *
+				  bench->wire_cpp;
+	}
+}
+
+// Flip to the back buffer with its damage, after the last flip was shown
+static void flip(struct bench *bench, const struct drm_mode_rect *clips,
+		 unsigned int num_clips)
+{
+	drmModeAtomicReq *req = drmModeAtomicAlloc();
+	uint32_t blob = 0;
+	uint64_t start;
+
+	bench->front ^= 1;
+	if (num_clips &&
+	    drmModeCreatePropertyBlob(bench->fd, clips,
+				      num_clips * sizeof(*clips), &blob))
+		die("damage blob");
+
+	drmModeAtomicAddProperty(req, bench->primary_id, bench->primary.fb_id,
+				 bench->fb[bench->front].fb_id);
+	drmModeAtomicAddProperty(req, bench->primary_id,
+				 bench->primary.damage_clips, blob);
+
+	start = now_ns();
+	if (drmModeAtomicCommit(bench->fd, req, 0, NULL))
+		die("flip");
+	record(bench, start, clips, num_clips, false);
+
+	drmModeAtomicFree(req);
+	if (blob)
+		drmModeDestroyPropertyBlob(bench->fd, blob);
+}
+
+// Front buffer rendering, as a compositor without page flips does it
+static void dirty(struct bench *bench, const struct drm_mode_rect *clips,
+		  unsigned int num_clips)
+{
+	drmModeClip dirty_clips[MAX_CLIPS];
+	uint64_t start;
+	unsigned int i;
+
+	for (i = 0; i < num_clips; i++) {
+		dirty_clips[i].x1 = clips[i].x1;
+		dirty_clips[i].y1 = clips[i].y1;
+		dirty_clips[i].x2 = clips[i].x2;
+		dirty_clips[i].y2 = clips[i].y2;
+	}
+
+	start = now_ns();
+	if (drmModeDirtyFB(bench->fd, bench->fb[bench->front].fb_id,
+			   dirty_clips, num_clips))
+		die("dirtyfb");
+	record(bench, start, clips, num_clips, false);
+}
+
+static void fill_rect(struct buffer *buf, const struct drm_mode_rect *rect,
+		      uint32_t color)
+{
+	uint32_t *row;
+	int x, y;
+
+	for (y = rect->y1; y < rect->y2; y++) {
+		row = buf->map + y * (buf->pitch / 4);
+		for (x = rect->x1; x < rect->x2; x++)
+			row[x] = color;
+	}
+}
+
+// Sleep until the next frame of the requested rate, if any
+static void pace(struct bench *bench, uint64_t start)
+{
+	uint64_t next, now;
+	struct timespec ts;
+
+	if (!bench->fps)
+		return;
+	next = start + (uint64_t)bench->frames * 1000000000ull / bench->fps;
+	now = now_ns();
+	if (next <= now)
+		return;
+	ts.tv_sec = (next - now) / 1000000000ull;
+	ts.tv_nsec = (next - now) % 1000000000ull;
+	nanosleep(&ts, NULL);
+}
+
+static bool running(struct bench *bench, uint64_t start)
+{
+	pace(bench, start);
+	return now_ns() - start < bench->duration * 1e9;
+}
+
+// Every pixel changes every frame
+static void run_video(struct bench *bench)
+{
+	struct drm_mode_rect clip = { 0, 0, bench->mode.hdisplay,
+				      bench->mode.vdisplay };
+	uint64_t start = now_ns();
+	struct buffer *back;
+	uint32_t *row;
+	unsigned int frame = 0;
+	int x, y;
+
+	while (running(bench, start)) {
+		back = &bench->fb[bench->front ^ 1];
+		for (y = 0; y < clip.y2; y++) {
+			row = back->map + y * (back->pitch / 4);
+			for (x = 0; x < clip.x2; x++)
+				row[x] = (x + frame) * 0x010203 ^
+					 (y - frame) * 0x030201;
+		}
+		flip(bench, &clip, 1);
+		frame++;
+	}
+}
+
+// A window scrolling its contents by a few lines a frame
+static void run_scroll(struct bench *bench)
+{
+	unsigned int width = bench->mode.hdisplay * 2 / 3;
+	unsigned int height = bench->mode.vdisplay * 2 / 3;
+	struct drm_mode_rect window = {
+		(bench->mode.hdisplay - width) / 2,
+		(bench->mode.vdisplay - height) / 2,
+		(bench->mode.hdisplay + width) / 2,
+		(bench->mode.vdisplay + height) / 2,
+	};
+	const unsigned int step = 8;
+	uint64_t start = now_ns();
+	struct buffer *front, *back;
+	struct drm_mode_rect line;
+	unsigned int frame = 0;
+	int y;
+
+	while (running(bench, start)) {
+		front = &bench->fb[bench->front];
+		back = &bench->fb[bench->front ^ 1];
+		for (y = window.y1; y < window.y2 - (int)step; y++)
+			memcpy(back->map + y * (back->pitch / 4) + window.x1,
+			       front->map + (y + step) * (front->pitch / 4) +
+				       window.x1,
+			       width * 4);
+		// A new line of text coming in at the bottom
+		line = window;
+		line.y1 = window.y2 - step;
+		fill_rect(back, &line, frame & 1 ? 0x00303030 : 0x00e0e0e0);
+		flip(bench, &window, 1);
+		frame++;
+	}
+}
+
+// Glyphs appearing at a few scattered places a frame
+static void run_typing(struct bench *bench)
+{
+	struct drm_mode_rect clips[3];
+	uint64_t start = now_ns();
+	struct buffer *front = &bench->fb[bench->front];
+	unsigned int i, num, frame = 0;
+
+	srand(1);
+	while (running(bench, start)) {
+		num = 1 + rand() % 3;
+		for (i = 0; i < num; i++) {
+			clips[i].x1 = rand() % (bench->mode.hdisplay - 8);
+			clips[i].y1 = rand() % (bench->mode.vdisplay - 16);
+			clips[i].x2 = clips[i].x1 + 8;
+			clips[i].y2 = clips[i].y1 + 16;
+			fill_rect(front, &clips[i], 0x00101010 * (frame & 15));
+		}
+		dirty(bench, clips, num);
+		frame++;
+	}
+}
+
+// The cursor plane moving along a circle, the primary untouched
+static void run_cursor(struct bench *bench)
+{
+	struct drm_mode_rect arrow = { 0, 0, 12, 20 };
+	struct drm_mode_rect moved[2] = {
+		{ 0, 0, CURSOR_SIZE, CURSOR_SIZE },
+		{ 0, 0, CURSOR_SIZE, CURSOR_SIZE },
+	};
+	drmModeAtomicReq *req;
+	uint64_t start = now_ns(), t;
+	unsigned int frame = 0;
+	int x, y;
+
+	if (!bench->cursor_id) {
+		fprintf(stderr, "cursor: no cursor plane\n");
+		return;
+	}
+
+	fill_rect(&bench->cursor_fb, &arrow, 0xffffffff);
+	while (running(bench, start)) {
+		x = bench->mode.hdisplay / 2 +
+		    (int)(bench->mode.hdisplay / 3 * ((frame % 120) - 60) / 60);
+		y = bench->mode.vdisplay / 2 +
+		    (int)(bench->mode.vdisplay / 3 * ((frame % 90) - 45) / 45);
+		moved[1] = moved[0];
+		moved[0] = (struct drm_mode_rect){ x, y, x + CURSOR_SIZE,
+						   y + CURSOR_SIZE };
+
+		req = drmModeAtomicAlloc();
+		add_plane(req, bench->cursor_id, &bench->cursor,
+			  &bench->cursor_fb, bench->crtc_id, x, y);
+		t = now_ns();
+		if (drmModeAtomicCommit(bench->fd, req, 0, NULL))
+			die("cursor");
+		drmModeAtomicFree(req);
+		// The rectangles the cursor left and entered
+		record(bench, t, moved, frame ? 2 : 1, true);
+		frame++;
+	}
+
+	// Take the cursor down again so later scenarios don't compose it
+	req = drmModeAtomicAlloc();
+	drmModeAtomicAddProperty(req, bench->cursor_id, bench->cursor.fb_id, 0);
+	drmModeAtomicAddProperty(req, bench->cursor_id, bench->cursor.crtc_id,
+				 0);
+	drmModeAtomicCommit(bench->fd, req, 0, NULL);
+	drmModeAtomicFree(req);
+}
+
+// Nothing changes, anything on the wire is overhead
+static void run_idle(struct bench *bench)
+{
+	struct timespec ts = {
+		.tv_sec = (time_t)bench->duration,
+		.tv_nsec = (long)((bench->duration - (time_t)bench->duration) *
+				  1e9),
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+static const struct scenario scenarios[] = {
+	{ "video", run_video },
+	{ "scroll", run_scroll },
+	{ "typing", run_typing },
+	{ "cursor", run_cursor },
+	{ "idle", run_idle },
+};
+
+// Whether name is in the comma separated list, every scenario without one
+static bool is_selected(const char *selected, const char *name)
+{
+	size_t len = strlen(name);
+	const char *hit;
+
+	if (!selected)
+		return true;
+	for (hit = strstr(selected, name); hit; hit = strstr(hit + 1, name))
+		if ((hit == selected || hit[-1] == ',') &&
+		    (!hit[len] || hit[len] == ','))
+			return true;
+	return false;
+}
+
+// A value from the driver's debugfs stats, or -1 without debugfs
+static int64_t read_stat(struct bench *bench, const char *key)
+{
+	char path[64], line[128], format[64];
+	long long value = -1;
+	FILE *file;
+
+	snprintf(path, sizeof(path), "/sys/kernel/debug/dri/%u/stats",
+		 bench->minor);
+	snprintf(format, sizeof(format), "%s: %%lld", key);
+	file = fopen(path, "r");
+	if (!file)
+		return -1;
+	while (fgets(line, sizeof(line), file))
+		if (sscanf(line, format, &value) == 1)
+			break;
+	fclose(file);
+	return value;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const struct bench *bench, unsigned int pct)
+{
+	unsigned int i;
+
+	if (!bench->frames)
+		return 0;
+	i = (bench->frames - 1) * pct / 100;
+	return bench->latency[i] / 1e6;
+}
+
+static void report(struct bench *bench, const char *name, double seconds,
+		   int64_t wire, bool csv)
+{
+	double fps = bench->frames / seconds;
+	double damage = bench->frames ?
+				(double)bench->damage_bytes / bench->frames :
+				0;
+	double cursor = bench->frames ?
+				(double)bench->cursor_bytes / bench->frames :
+				0;
+	double wire_per_frame = wire < 0 ? -1 :
+				bench->frames ? (double)wire / bench->frames :
+						wire;
+
+	qsort(bench->latency, bench->frames, sizeof(uint64_t), cmp_u64);
+	if (csv) {
+		printf("%s,%.2f,%.3f,%.3f,%.3f,%.3f,%.0f,%.0f,%.0f\n", name,
+		       fps, percentile(bench, 50), percentile(bench, 90),
+		       percentile(bench, 99), percentile(bench, 100), damage,
+		       cursor, wire_per_frame);
+		return;
+	}
+
+	printf("%-7s %8.2f fps  latency ms p50 %7.3f p90 %7.3f p99 %7.3f max %7.3f  damage %9.0f B/frame",
+	       name, fps, percentile(bench, 50), percentile(bench, 90),
+	       percentile(bench, 99), percentile(bench, 100), damage);
+	if (bench->cursor_bytes)
+		printf("  cursor %7.0f B/frame", cursor);
+	if (wire >= 0)
+		printf("  wire %9.0f B%s", wire_per_frame,
+		       bench->frames ? "/frame" : "");
+	printf("\n");
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-d /dev/dri/cardN] [-s scenario,...] [-t seconds] [-f fps] [-c]\n"
+		"  -d  device node (default: the first trigger5 card)\n"
+		"  -s  scenarios to run: video, scroll, typing, cursor, idle\n"
+		"  -t  duration of each scenario (default 5 s)\n"
+		"  -f  frame rate to pace at, 0 to run unpaced (default 60)\n"
+		"  -c  print CSV: scenario,fps,p50,p90,p99,max,damage,cursor,wire\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench bench = { .fps = 60, .duration = 5 };
+	const char *path = NULL, *selected = NULL;
+	bool csv = false;
+	int64_t wire_start, wire_end, wire_bpp;
+	uint64_t start;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:s:t:f:c")) != -1) {
+		switch (opt) {
+		case 'd':
+			path = optarg;
+			break;
+		case 's':
+			selected = optarg;
+			break;
+		case 't':
+			bench.duration = strtod(optarg, NULL);
+			break;
+		case 'f':
+			bench.fps = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			csv = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (bench.duration <= 0)
+		usage(argv[0]);
+
+	bench.fd = open_trigger5(path);
+	if (bench.fd < 0)
+		die(path ? path : "no trigger5 device");
+
+	setup(&bench);
+	modeset(&bench);
+	if (!csv)
+		printf("%ux%u@%u, %u fps pacing, %.1f s per scenario\n",
+		       bench.mode.hdisplay, bench.mode.vdisplay,
+		       bench.mode.vrefresh, bench.fps, bench.duration);
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		const char *name = scenarios[i].name;
+
+		if (!is_selected(selected, name))
+			continue;
+
+		bench.frames = 0;
+		bench.damage_bytes = 0;
+		bench.cursor_bytes = 0;
+		// Let the previous scenario drain before measuring
+		usleep(200000);
+
+		// The quality controller may have changed the depth since
+		wire_bpp = read_stat(&bench, "wire_bpp");
+		bench.wire_cpp = wire_bpp > 0 ? wire_bpp / 8 : 3;
+
+		wire_start = read_stat(&bench, "bytes_sent");
+		start = now_ns();
+		scenarios[i].run(&bench);
+		wire_end = read_stat(&bench, "bytes_sent");
+
+		report(&bench, name, (now_ns() - start) / 1e9,
+		       wire_start < 0 || wire_end < 0 ? -1 :
+							wire_end - wire_start,
+		       csv);
+	}
+
+	free(bench.latency);
+	for (i = 0; i < 2; i++)
+		destroy_buffer(bench.fd, &bench.fb[i]);
+	if (bench.cursor_id)
+		destroy_buffer(bench.fd, &bench.cursor_fb);
+	close(bench.fd);
+	return 0;
+}
@@ -0,0 +1,885 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Userspace emulation of a Trigger 5 adapter on top of dummy_hcd and Raw
+ * Gadget, so the driver can be probed, modeset and benchmarked end to end
+ * without hardware:
+ *
+ *   modprobe dummy_hcd
+ *   modprobe raw_gadget
+ *   ./tools/trigger5_emu -o last.ppm
+ *
+ * The emulator answers the vendor control requests the driver sends,
+ * sinks bulk endpoint 0x01 and checks every bulk header on the way. It
+ * reports throughput and the timing between updates once per interval and
+ * can save the last screen it decoded as a PPM image.
+ *
+ * Updates have no marker on the wire, so a header arriving after the bus
+ * was idle for longer than the gap (-g) is counted as a new update.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#define TRIGGER5_VENDOR			0x0711
+#define TRIGGER5_PRODUCT		0x5800
+
+#define TRIGGER5_REQUEST_GET_MODE	0xa4
+#define TRIGGER5_REQUEST_GET_STATUS	0xa6
+#define TRIGGER5_REQUEST_GET_EDID	0xa8
+#define TRIGGER5_REQUEST_SET_MODE	0xc3
+
+#define EP0_MAX_DATA			4096
+#define BULK_READ_SIZE			(64 * 1024)
+
+// Wire structures, matching trigger5.h
+struct trigger5_mode {
+	uint8_t hz;
+	uint8_t clock_mhz;
+	uint8_t bpp;
+	uint8_t mode_number;
+	uint16_t height;
+	uint16_t width;
+} __attribute__((packed));
+
+struct trigger5_mode_list {
+	uint16_t count;
+	uint8_t padding[2];
+	struct trigger5_mode modes[52];
+} __attribute__((packed));
+
+struct trigger5_bulk_header {
+	uint8_t magic;
+	uint8_t length;
+	uint16_t counter;
+	uint16_t horizontal_offset;
+	uint16_t vertical_offset;
+	uint16_t width;
+	uint16_t height;
+	uint32_t payload_length;
+	uint8_t flags;
+	uint8_t unknown1;
+	uint8_t unknown2;
+	uint8_t checksum;
+} __attribute__((packed));
+
+struct trigger6_mode_request {
+	uint16_t height;
+	uint16_t width;
+	uint16_t line_total_pixels;
+	uint16_t line_sync_pulse;
+	uint16_t line_back_porch;
+	uint16_t unknown1;
+	uint16_t unknown2;
+	uint16_t width_minus_one;
+	uint16_t frame_total_lines;
+	uint16_t frame_sync_pulse;
+	uint16_t frame_back_porch;
+	uint16_t unknown3;
+	uint16_t unknown4;
+	uint16_t height_minus_one;
+	uint8_t pll[5];
+	uint8_t hsync_polarity;
+	uint8_t vsync_polarity;
+} __attribute__((packed));
+
+// Modes listed by GET_MODE, the last one is what unlisted modes get
+static const struct {
+	uint16_t width, height;
+	uint8_t hz, clock_mhz, bpp;
+} emu_modes[] = {
+	{ 1920, 1080, 60, 148, 16 },
+	{ 1280, 720, 60, 74, 16 },
+	{ 1024, 768, 60, 65, 16 },
+	{ 800, 600, 60, 40, 16 },
+	{ 1280, 720, 60, 74, 32 },
+	{ 1024, 768, 60, 65, 32 },
+	{ 800, 600, 60, 40, 32 },
+	{ 1920, 1080, 60, 148, 32 },
+};
+
+/*
+ * EDID 1.3 of a 1080p60 monitor: 640x480, 800x600 and 1024x768 established
+ * timings, 1280x720 as a standard timing and 1920x1080 as the preferred
+ * detailed timing. The checksum is filled in at startup.
+ */
+static uint8_t emu_edid[128] = {
+	0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00,
+	0x52, 0x47, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x01, 0x22, 0x01, 0x03, 0x80, 0x35, 0x1e, 0x78,
+	0x0a, 0xee, 0x91, 0xa3, 0x54, 0x4c, 0x99, 0x26,
+	0x0f, 0x50, 0x54, 0x21, 0x08, 0x00, 0x81, 0xc0,
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x3a,
+	0x80, 0x18, 0x71, 0x38, 0x2d, 0x40, 0x58, 0x2c,
+	0x45, 0x00, 0x13, 0x8e, 0x21, 0x00, 0x00, 0x1e,
+	0x00, 0x00, 0x00, 0xfc, 0x00, 't', 'r', 'i',
+	'g', 'g', 'e', 'r', '5', ' ', 'e', 'm',
+	'u', 0x0a, 0x00, 0x00, 0x00, 0xfd, 0x00, 0x38,
+	0x4c, 0x1e, 0x53, 0x11, 0x00, 0x0a, 0x20, 0x20,
+	0x20, 0x20, 0x20, 0x20, 0x00, 0x00, 0x00, 0x10,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+// Multi-byte fields are filled in little endian at startup
+static struct usb_device_descriptor emu_device = {
+	.bLength = USB_DT_DEVICE_SIZE,
+	.bDescriptorType = USB_DT_DEVICE,
+	.bDeviceClass = 0,
+	.bMaxPacketSize0 = 64,
+	.iManufacturer = 1,
+	.iProduct = 2,
+	.iSerialNumber = 3,
+	.bNumConfigurations = 1,
+};
+
+static struct usb_endpoint_descriptor emu_bulk_ep = {
+	.bLength = USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType = USB_DT_ENDPOINT,
+	.bEndpointAddress = USB_DIR_OUT | 1,
+	.bmAttributes = USB_ENDPOINT_XFER_BULK,
+};
+
+static const char *const emu_strings[] = { "trigger5-emu", "Trigger 5 emulator",
+					   "0001" };
+
+// Current mode, shared by the control and bulk threads
+struct emu_screen {
+	pthread_mutex_t lock;
+	unsigned int width;
+	unsigned int height;
+	unsigned int cpp;
+	uint8_t *pixels;
+};
+
+struct emu_stats {
+	uint64_t bytes;
+	uint64_t segments;
+	uint64_t updates;
+	uint64_t errors;
+	// Gaps between update starts, in ns
+	uint64_t gaps;
+	uint64_t gap_sum;
+	uint64_t gap_min;
+	uint64_t gap_max;
+	uint64_t last_update;
+};
+
+static struct emu_screen screen = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct emu_stats stats, totals;
+static volatile sig_atomic_t stop;
+static volatile sig_atomic_t connected = 1;
+static uint64_t gap_ns = 1000000;
+static bool verbose;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(EXIT_FAILURE);
+}
+
+static unsigned int emu_mode_cpp(int mode_number)
+{
+	unsigned int i, last = sizeof(emu_modes) / sizeof(emu_modes[0]) - 1;
+
+	for (i = 0; i <= last; i++)
+		if (i + 1 == (unsigned int)mode_number)
+			return emu_modes[i].bpp == 16 ? 2 : 3;
+	return emu_modes[last].bpp == 16 ? 2 : 3;
+}
+
+static void emu_fill_mode_list(struct trigger5_mode_list *list)
+{
+	unsigned int i, count = sizeof(emu_modes) / sizeof(emu_modes[0]);
+
+	memset(list, 0, sizeof(*list));
+	list->count = htobe16(count);
+	for (i = 0; i < count; i++) {
+		list->modes[i].hz = emu_modes[i].hz;
+		list->modes[i].clock_mhz = emu_modes[i].clock_mhz;
+		list->modes[i].bpp = emu_modes[i].bpp;
+		list->modes[i].mode_number = i + 1;
+		list->modes[i].width = htole16(emu_modes[i].width);
+		list->modes[i].height = htole16(emu_modes[i].height);
+	}
+}
+
+static void emu_set_mode(const struct trigger6_mode_request *request,
+			 int mode_number)
+{
+	unsigned int width = be16toh(request->width);
+	unsigned int height = be16toh(request->height);
+	unsigned int cpp = emu_mode_cpp(mode_number);
+
+	pthread_mutex_lock(&screen.lock);
+	free(screen.pixels);
+	screen.pixels = calloc(width * height, cpp);
+	screen.width = screen.pixels ? width : 0;
+	screen.height = screen.pixels ? height : 0;
+	screen.cpp = cpp;
+	pthread_mutex_unlock(&screen.lock);
+
+	printf("mode %d: %ux%u at %u bpp, htotal %u vtotal %u, pll %02x %02x %02x %02x %02x\n",
+	       mode_number, width, height, cpp * 8,
+	       be16toh(request->line_total_pixels) + 1,
+	       be16toh(request->frame_total_lines) + 1, request->pll[0],
+	       request->pll[1], request->pll[2], request->pll[3],
+	       request->pll[4]);
+}
+
+/*
+ * Control endpoint. Standard requests bring the device up, the vendor ones
+ * are answered from the tables above. Unknown vendor requests seen in the
+ * modeset sequence only need an answer of the right length.
+ */
+struct emu_control_event {
+	struct usb_raw_event inner;
+	struct usb_ctrlrequest ctrl;
+};
+
+struct emu_ep0_io {
+	struct usb_raw_ep_io inner;
+	uint8_t data[EP0_MAX_DATA];
+};
+
+static int emu_string(uint8_t index, uint8_t *buf)
+{
+	const char *str;
+	unsigned int i, len;
+
+	if (!index) {
+		buf[0] = 4;
+		buf[1] = USB_DT_STRING;
+		buf[2] = 0x09;
+		buf[3] = 0x04;
+		return 4;
+	}
+	if (index > sizeof(emu_strings) / sizeof(emu_strings[0]))
+		return -1;
+
+	str = emu_strings[index - 1];
+	len = strlen(str);
+	buf[0] = 2 + len * 2;
+	buf[1] = USB_DT_STRING;
+	for (i = 0; i < len; i++) {
+		buf[2 + i * 2] = str[i];
+		buf[3 + i * 2] = 0;
+	}
+	return buf[0];
+}
+
+static int emu_config(uint8_t *buf)
+{
+	struct usb_config_descriptor config = {
+		.bLength = USB_DT_CONFIG_SIZE,
+		.bDescriptorType = USB_DT_CONFIG,
+		.bNumInterfaces = 1,
+		.bConfigurationValue = 1,
+		.bmAttributes = USB_CONFIG_ATT_ONE,
+		.bMaxPower = 250,
+	};
+	struct usb_interface_descriptor intf = {
+		.bLength = USB_DT_INTERFACE_SIZE,
+		.bDescriptorType = USB_DT_INTERFACE,
+		.bInterfaceNumber = 0,
+		.bNumEndpoints = 1,
+		.bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+	};
+	unsigned int len = 0;
+
+	memcpy(buf + len, &config, sizeof(config));
+	len += sizeof(config);
+	memcpy(buf + len, &intf, sizeof(intf));
+	len += sizeof(intf);
+	memcpy(buf + len, &emu_bulk_ep, USB_DT_ENDPOINT_SIZE);
+	len += USB_DT_ENDPOINT_SIZE;
+
+	((struct usb_config_descriptor *)buf)->wTotalLength = htole16(len);
+	return len;
+}
+
+struct emu_bulk_args {
+	int fd;
+	int ep;
+};
+
+static void *emu_bulk_thread(void *arg);
+
+static void emu_configure(int fd)
+{
+	static bool configured;
+	static struct emu_bulk_args args;
+	pthread_t thread;
+
+	if (configured)
+		return;
+
+	args.fd = fd;
+	args.ep = ioctl(fd, USB_RAW_IOCTL_EP_ENABLE, &emu_bulk_ep);
+	if (args.ep < 0)
+		die("ep enable");
+	if (ioctl(fd, USB_RAW_IOCTL_VBUS_DRAW, 250) < 0)
+		die("vbus draw");
+	if (ioctl(fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0)
+		die("configure");
+	if (pthread_create(&thread, NULL, emu_bulk_thread, &args))
+		die("bulk thread");
+	pthread_detach(thread);
+	configured = true;
+}
+
+// Returns the length of the IN data, 0 for no data stage, -1 to stall
+static int emu_standard(int fd, const struct usb_ctrlrequest *ctrl,
+			uint8_t *buf)
+{
+	uint16_t value = le16toh(ctrl->wValue);
+
+	switch (ctrl->bRequest) {
+	case USB_REQ_GET_DESCRIPTOR:
+		switch (value >> 8) {
+		case USB_DT_DEVICE:
+			memcpy(buf, &emu_device, sizeof(emu_device));
+			return sizeof(emu_device);
+		case USB_DT_CONFIG:
+			return emu_config(buf);
+		case USB_DT_STRING:
+			return emu_string(value & 0xff, buf);
+		}
+		return -1;
+	case USB_REQ_SET_CONFIGURATION:
+		emu_configure(fd);
+		return 0;
+	case USB_REQ_SET_INTERFACE:
+		return 0;
+	case USB_REQ_GET_INTERFACE:
+	case USB_REQ_GET_CONFIGURATION:
+		buf[0] = ctrl->bRequest == USB_REQ_GET_CONFIGURATION;
+		return 1;
+	case USB_REQ_GET_STATUS:
+		buf[0] = 0;
+		buf[1] = 0;
+		return 2;
+	}
+	return -1;
+}
+
+static int emu_vendor_in(const struct usb_ctrlrequest *ctrl, uint8_t *buf)
+{
+	uint16_t value = le16toh(ctrl->wValue);
+	uint16_t length = le16toh(ctrl->wLength);
+
+	memset(buf, 0, length);
+	switch (ctrl->bRequest) {
+	case TRIGGER5_REQUEST_GET_MODE:
+		emu_fill_mode_list((struct trigger5_mode_list *)buf);
+		return sizeof(struct trigger5_mode_list);
+	case TRIGGER5_REQUEST_GET_STATUS:
+		buf[1] = connected;
+		return 2;
+	case TRIGGER5_REQUEST_GET_EDID:
+		// Only the base block, the driver reads it in one go
+		if (value)
+			return -1;
+		memcpy(buf, emu_edid, sizeof(emu_edid));
+		return sizeof(emu_edid);
+	}
+	return length;
+}
+
+static void emu_vendor_out(const struct usb_ctrlrequest *ctrl,
+			   const uint8_t *buf, unsigned int len)
+{
+	if (ctrl->bRequest == TRIGGER5_REQUEST_SET_MODE &&
+	    len >= sizeof(struct trigger6_mode_request))
+		emu_set_mode((const struct trigger6_mode_request *)buf,
+			     le16toh(ctrl->wValue));
+}
+
+static void emu_control(int fd, const struct usb_ctrlrequest *ctrl)
+{
+	static struct emu_ep0_io io;
+	uint16_t length = le16toh(ctrl->wLength);
+	int ret;
+
+	if (verbose)
+		printf("ctrl: type %02x request %02x value %04x index %04x length %u\n",
+		       ctrl->bRequestType, ctrl->bRequest,
+		       le16toh(ctrl->wValue), le16toh(ctrl->wIndex), length);
+
+	if (length > EP0_MAX_DATA)
+		goto stall;
+
+	io.inner.ep = 0;
+	io.inner.flags = 0;
+
+	if (!(ctrl->bRequestType & USB_DIR_IN) && length) {
+		// Data comes from the host, only vendor requests carry any
+		if ((ctrl->bRequestType & USB_TYPE_MASK) != USB_TYPE_VENDOR)
+			goto stall;
+		io.inner.length = length;
+		ret = ioctl(fd, USB_RAW_IOCTL_EP0_READ, &io);
+		if (ret < 0)
+			die("ep0 read");
+		emu_vendor_out(ctrl, io.data, ret);
+		return;
+	}
+
+	if ((ctrl->bRequestType & USB_TYPE_MASK) == USB_TYPE_STANDARD)
+		ret = emu_standard(fd, ctrl, io.data);
+	else if ((ctrl->bRequestType & USB_TYPE_MASK) == USB_TYPE_VENDOR)
+		ret = ctrl->bRequestType & USB_DIR_IN ?
+			      emu_vendor_in(ctrl, io.data) : 0;
+	else
+		ret = -1;
+	if (ret < 0)
+		goto stall;
+
+	if (ctrl->bRequestType & USB_DIR_IN) {
+		io.inner.length = ret < length ? ret : length;
+		if (ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, &io) < 0)
+			die("ep0 write");
+	} else {
+		// Acknowledge the status stage
+		io.inner.length = 0;
+		if (ioctl(fd, USB_RAW_IOCTL_EP0_READ, &io) < 0)
+			die("ep0 ack");
+	}
+	return;
+
+stall:
+	if (ioctl(fd, USB_RAW_IOCTL_EP0_STALL, 0) < 0)
+		die("ep0 stall");
+}
+
+/*
+ * Bulk stream decoder. Headers and payload arrive split at arbitrary
+ * points, so both are collected across reads.
+ */
+struct emu_decoder {
+	uint8_t header[sizeof(struct trigger5_bulk_header)];
+	unsigned int header_len;
+	// Segment being received, in bytes left and its place on screen
+	unsigned int payload_left;
+	unsigned int x, y, width, height, offset;
+	int counter;
+	bool valid;
+	uint64_t last_data;
+};
+
+static bool emu_check_header(struct emu_decoder *dec,
+			     const struct trigger5_bulk_header *header)
+{
+	const uint8_t *bytes = (const uint8_t *)header;
+	unsigned int i, x, y, width, height, counter, len;
+	uint8_t sum = 0;
+
+	for (i = 0; i < sizeof(*header); i++)
+		sum += bytes[i];
+	if (header->magic != 0xfb || header->length != 0x14 || sum) {
+		if (verbose)
+			printf("bulk: bad magic, length or checksum\n");
+		return false;
+	}
+
+	counter = le16toh(header->counter);
+	x = le16toh(header->horizontal_offset);
+	y = le16toh(header->vertical_offset);
+	width = le16toh(header->width);
+	height = le16toh(header->height);
+	len = le32toh(header->payload_length);
+
+	// Counters run on across segments and frames, a gap means loss
+	if (dec->counter >= 0 && counter != ((dec->counter + 1) & 0xfff)) {
+		if (verbose)
+			printf("bulk: counter %u after %d\n", counter,
+			       dec->counter);
+		pthread_mutex_lock(&stats_lock);
+		stats.errors++;
+		pthread_mutex_unlock(&stats_lock);
+	}
+	dec->counter = counter;
+
+	pthread_mutex_lock(&screen.lock);
+	dec->valid = screen.pixels && x + width <= screen.width &&
+		     y + height <= screen.height &&
+		     len == width * height * screen.cpp;
+	pthread_mutex_unlock(&screen.lock);
+	if (!dec->valid && verbose)
+		printf("bulk: segment %ux%u+%u+%u with %u bytes does not fit the mode\n",
+		       width, height, x, y, len);
+
+	dec->payload_left = len;
+	dec->x = x;
+	dec->y = y;
+	dec->width = width;
+	dec->height = height;
+	dec->offset = 0;
+	return true;
+}
+
+static void emu_start_segment(struct emu_decoder *dec, uint64_t now)
+{
+	pthread_mutex_lock(&stats_lock);
+	stats.segments++;
+	if (!dec->valid)
+		stats.errors++;
+	// A header after the bus went idle starts a new update
+	if (now - dec->last_data > gap_ns) {
+		if (stats.last_update) {
+			uint64_t gap = now - stats.last_update;
+
+			stats.gaps++;
+			stats.gap_sum += gap;
+			if (!stats.gap_min || gap < stats.gap_min)
+				stats.gap_min = gap;
+			if (gap > stats.gap_max)
+				stats.gap_max = gap;
+		}
+		stats.last_update = now;
+		stats.updates++;
+	}
+	pthread_mutex_unlock(&stats_lock);
+}
+
+// Copy payload bytes into the screen, row by row
+static void emu_store(struct emu_decoder *dec, const uint8_t *data,
+		      unsigned int len)
+{
+	unsigned int cpp, pitch, row, col, chunk;
+
+	pthread_mutex_lock(&screen.lock);
+	cpp = screen.cpp;
+	pitch = dec->width * cpp;
+	while (dec->valid && len && pitch) {
+		row = dec->offset / pitch;
+		col = dec->offset % pitch;
+		chunk = pitch - col < len ? pitch - col : len;
+		memcpy(screen.pixels +
+			       ((dec->y + row) * screen.width + dec->x) * cpp +
+			       col,
+		       data, chunk);
+		dec->offset += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+	pthread_mutex_unlock(&screen.lock);
+}
+
+static void emu_decode(struct emu_decoder *dec, const uint8_t *data,
+		       unsigned int len, uint64_t now)
+{
+	unsigned int chunk;
+
+	while (len) {
+		if (dec->payload_left) {
+			chunk = dec->payload_left < len ? dec->payload_left :
+							   len;
+			emu_store(dec, data, chunk);
+			dec->payload_left -= chunk;
+			data += chunk;
+			len -= chunk;
+			continue;
+		}
+
+		// Resynchronise on the magic byte after a bad header
+		if (!dec->header_len && *data != 0xfb) {
+			data++;
+			len--;
+			continue;
+		}
+
+		chunk = sizeof(dec->header) - dec->header_len;
+		chunk = chunk < len ? chunk : len;
+		memcpy(dec->header + dec->header_len, data, chunk);
+		dec->header_len += chunk;
+		data += chunk;
+		len -= chunk;
+		if (dec->header_len < sizeof(dec->header))
+			continue;
+
+		dec->header_len = 0;
+		if (!emu_check_header(
+			    dec, (struct trigger5_bulk_header *)dec->header)) {
+			pthread_mutex_lock(&stats_lock);
+			stats.errors++;
+			pthread_mutex_unlock(&stats_lock);
+			continue;
+		}
+		emu_start_segment(dec, now);
+	}
+	dec->last_data = now;
+}
+
+static void *emu_bulk_thread(void *arg)
+{
+	struct emu_bulk_args *args = arg;
+	struct emu_decoder dec = { .counter = -1 };
+	struct usb_raw_ep_io *io;
+	uint64_t now;
+	int ret;
+
+	io = malloc(sizeof(*io) + BULK_READ_SIZE);
+	if (!io)
+		die("bulk buffer");
+
+	while (!stop) {
+		io->ep = args->ep;
+		io->flags = 0;
+		io->length = BULK_READ_SIZE;
+		ret = ioctl(args->fd, USB_RAW_IOCTL_EP_READ, io);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			// The host went away, wait for it to come back
+			if (errno == ESHUTDOWN || errno == EPIPE) {
+				usleep(100000);
+				continue;
+			}
+			die("bulk read");
+		}
+		now = now_ns();
+		pthread_mutex_lock(&stats_lock);
+		stats.bytes += ret;
+		pthread_mutex_unlock(&stats_lock);
+		emu_decode(&dec, io->data, ret, now);
+	}
+
+	free(io);
+	return NULL;
+}
+
+static void emu_report(const struct emu_stats *s, double seconds,
+		       const char *label)
+{
+	printf("%s: %.1f updates/s, %.1f segments/s, %.2f MB/s, gap avg %.2f min %.2f max %.2f ms, %llu errors\n",
+	       label, s->updates / seconds, s->segments / seconds,
+	       s->bytes / seconds / 1e6,
+	       s->gaps ? s->gap_sum / 1e6 / s->gaps : 0.0, s->gap_min / 1e6,
+	       s->gap_max / 1e6, (unsigned long long)s->errors);
+}
+
+static void emu_stats_merge(struct emu_stats *total,
+			    const struct emu_stats *s)
+{
+	total->bytes += s->bytes;
+	total->segments += s->segments;
+	total->updates += s->updates;
+	total->errors += s->errors;
+	total->gaps += s->gaps;
+	total->gap_sum += s->gap_sum;
+	if (s->gap_min && (!total->gap_min || s->gap_min < total->gap_min))
+		total->gap_min = s->gap_min;
+	if (s->gap_max > total->gap_max)
+		total->gap_max = s->gap_max;
+}
+
+static void *emu_report_thread(void *arg)
+{
+	unsigned int interval = *(unsigned int *)arg;
+	uint64_t last = now_ns(), now;
+	struct emu_stats window;
+
+	while (!stop) {
+		sleep(interval);
+		now = now_ns();
+
+		pthread_mutex_lock(&stats_lock);
+		window = stats;
+		emu_stats_merge(&totals, &stats);
+		memset(&stats, 0, sizeof(stats));
+		// Keep measuring gaps across the window boundary
+		stats.last_update = window.last_update;
+		pthread_mutex_unlock(&stats_lock);
+
+		emu_report(&window, (now - last) / 1e9, "window");
+		last = now;
+		fflush(stdout);
+	}
+	return NULL;
+}
+
+// Save the screen as RGB, expanding 16 bpp on the way
+static void emu_save_ppm(const char *path)
+{
+	unsigned int i, pixel;
+	uint8_t rgb[3];
+	const uint8_t *src;
+	FILE *file;
+
+	pthread_mutex_lock(&screen.lock);
+	if (!screen.pixels) {
+		pthread_mutex_unlock(&screen.lock);
+		return;
+	}
+
+	file = fopen(path, "wb");
+	if (!file) {
+		perror(path);
+		pthread_mutex_unlock(&screen.lock);
+		return;
+	}
+
+	fprintf(file, "P6\n%u %u\n255\n", screen.width, screen.height);
+	for (i = 0, src = screen.pixels; i < screen.width * screen.height;
+	     i++, src += screen.cpp) {
+		if (screen.cpp == 2) {
+			pixel = src[0] | src[1] << 8;
+			rgb[0] = (pixel >> 11) << 3;
+			rgb[1] = ((pixel >> 5) & 0x3f) << 2;
+			rgb[2] = (pixel & 0x1f) << 3;
+		} else {
+			// The wire carries B, G, R
+			rgb[0] = src[2];
+			rgb[1] = src[1];
+			rgb[2] = src[0];
+		}
+		fwrite(rgb, 1, 3, file);
+	}
+	fclose(file);
+	pthread_mutex_unlock(&screen.lock);
+}
+
+static void emu_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		connected = !connected;
+	else
+		stop = 1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-d driver] [-u device] [-p pid] [-g gap_us] [-r seconds] [-o file.ppm] [-v]\n"
+		"  -d  UDC driver name (default dummy_udc)\n"
+		"  -u  UDC device name (default dummy_udc.0)\n"
+		"  -p  product id to present (default 0x5800)\n"
+		"  -g  bus idle time that separates updates (default 1000 us)\n"
+		"  -r  report interval (default 1 s)\n"
+		"  -o  save the last decoded screen on exit\n"
+		"  -v  log control requests and bulk errors\n"
+		"SIGUSR1 toggles the reported monitor connection.\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct usb_raw_init init = { .speed = USB_SPEED_HIGH };
+	const char *driver = "dummy_udc", *device = "dummy_udc.0";
+	const char *output = NULL;
+	unsigned int product = TRIGGER5_PRODUCT;
+	static unsigned int interval = 1;
+	struct emu_control_event event;
+	struct sigaction sa = { .sa_handler = emu_signal };
+	uint64_t start;
+	pthread_t report;
+	unsigned int i;
+	uint8_t sum = 0;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "d:u:p:g:r:o:v")) != -1) {
+		switch (opt) {
+		case 'd':
+			driver = optarg;
+			break;
+		case 'u':
+			device = optarg;
+			break;
+		case 'p':
+			product = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			gap_ns = strtoull(optarg, NULL, 0) * 1000;
+			break;
+		case 'r':
+			interval = strtoul(optarg, NULL, 0);
+			if (!interval)
+				usage(argv[0]);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	emu_device.bcdUSB = htole16(0x0200);
+	emu_device.idVendor = htole16(TRIGGER5_VENDOR);
+	emu_device.idProduct = htole16(product);
+	emu_device.bcdDevice = htole16(0x0100);
+	emu_bulk_ep.wMaxPacketSize = htole16(512);
+
+	for (i = 0; i < sizeof(emu_edid) - 1; i++)
+		sum += emu_edid[i];
+	emu_edid[sizeof(emu_edid) - 1] = -sum;
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	fd = open("/dev/raw-gadget", O_RDWR);
+	if (fd < 0)
+		die("/dev/raw-gadget");
+
+	snprintf((char *)init.driver_name, UDC_NAME_LENGTH_MAX, "%s", driver);
+	snprintf((char *)init.device_name, UDC_NAME_LENGTH_MAX, "%s", device);
+	if (ioctl(fd, USB_RAW_IOCTL_INIT, &init) < 0)
+		die("init");
+	if (ioctl(fd, USB_RAW_IOCTL_RUN, 0) < 0)
+		die("run");
+
+	start = now_ns();
+	if (pthread_create(&report, NULL, emu_report_thread, &interval))
+		die("report thread");
+
+	while (!stop) {
+		event.inner.type = 0;
+		event.inner.length = sizeof(event.ctrl);
+		if (ioctl(fd, USB_RAW_IOCTL_EVENT_FETCH, &event) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("event fetch");
+		}
+		if (event.inner.type == USB_RAW_EVENT_CONTROL)
+			emu_control(fd, &event.ctrl);
+	}
+
+	pthread_mutex_lock(&stats_lock);
+	emu_stats_merge(&totals, &stats);
+	pthread_mutex_unlock(&stats_lock);
+	emu_report(&totals, (now_ns() - start) / 1e9, "total");
+
+	if (output)
+		emu_save_ppm(output);
+	close(fd);
+	return 0;
+}
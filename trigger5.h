@@ -2,13 +2,20 @@
 #ifndef trigger5_H
 #define trigger5_H
 
+#include <linux/hrtimer.h>
+#include <linux/iosys-map.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
 #include <linux/mm_types.h>
 #include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 #include <linux/usb.h>
 
 #include <drm/drm_device.h>
 #include <drm/drm_framebuffer.h>
 #include <drm/drm_gem.h>
+#include <drm/drm_gem_shmem_helper.h>
+#include <drm/drm_rect.h>
 #include <drm/drm_simple_kms_helper.h>
 
 #define DRIVER_NAME		"trigger5"
@@ -34,24 +41,178 @@ struct trigger5_mode_list {
 	struct trigger5_mode modes[52];
 } __attribute__((packed));
 
-struct trigger5_device {
-	struct drm_device drm;
-	struct usb_interface *intf;
-	struct device *dmadev;
+struct trigger5_bulk_header {
+	u8 magic; //0xfb
+	u8 length; //0x14
+	__le16 counter; //12 bits
+	__le16 horizontal_offset;
+	__le16 vertical_offset;
+	__le16 width;
+	__le16 height;
+	__le32 payload_length; //upper 4 bits = 0x3
+	u8 flags; //0
+	u8 unknown1; //0
+	u8 unknown2; //0
+	u8 checksum;
+} __attribute__((packed));
 
-	struct drm_connector connector;
-	struct drm_simple_display_pipe display_pipe;
+/*
+ * Number of bulk buffers in the frame ring. While one buffer is on the bus
+ * the worker can already convert into the next.
+ */
+#define TRIGGER5_NUM_FRAMES	3
 
-	struct trigger5_mode_list mode_list;
-	u16 frame_counter;
-	unsigned int frame_len;
-	u8 *frame_data;
-	struct sg_table transfer_sgt;
+// Damage rectangles sent as separate segments of one bulk transfer
+#define TRIGGER5_MAX_DAMAGE_RECTS	16
+
+// Most stripes a large rectangle is converted in, each on its own thread
+#define TRIGGER5_MAX_STRIPES	8
+
+// URBs worth of rows converted before they are handed to the bus
+#define TRIGGER5_STREAM_URBS	4
+
+struct trigger5_frame {
+	// Allocated size of data, mapped from pages
+	unsigned int size;
+	u8 *data;
+	struct page **pages;
+	struct sg_table sgt;
+	// Header and framebuffer pages of a zero-copy transfer
+	struct trigger5_bulk_header *header;
+	struct sg_table zc_sgt;
+	struct drm_gem_shmem_object *shmem;
+	// Completed when the buffer is free to be filled again
+	struct completion complete;
+
+	// Counter of the first bulk header, used to follow the frame in traces
+	u16 counter;
+	// Flip completed once the frame is on the wire, under queue_lock
+	struct drm_pending_vblank_event *event;
+	// Damage carried by the frame, resent if a newer commit replaces it
+	struct drm_rect rects[TRIGGER5_MAX_DAMAGE_RECTS];
+	unsigned int num_rects;
+
+	// Submission state, protected by queue_lock
+	unsigned int len;
+	// Bytes filled in so far, URBs never go past this
+	unsigned int ready;
+	unsigned int submitted;
+	unsigned int in_flight;
+	struct scatterlist *cursor;
+	unsigned int cursor_offset;
+	bool timed_out;
+	// Time the commit started and the first URB went out, in ns
+	u64 commit_time;
+	u64 submit_time;
+};
+
+struct trigger5_urb {
+	struct trigger5_device *trigger5;
+	struct urb *urb;
+	struct scatterlist *sg;
 	struct timer_list timer;
-	struct usb_sg_request sgr;
+	// Set by the timer for the submission in flight, under queue_lock
+	bool timed_out;
+	// Kept off the idle mask while the timer unlinks it
+	bool unlinking;
+	struct trigger5_frame *frame;
+};
+
+// Power of two buckets in microseconds, the last one is open ended
+#define TRIGGER5_HIST_BUCKETS	16
+
+struct trigger5_histogram {
+	atomic64_t buckets[TRIGGER5_HIST_BUCKETS];
+};
+
+static inline void trigger5_hist_add(struct trigger5_histogram *hist, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	unsigned int bucket = us ? fls64(us) : 0;
+
+	atomic64_inc(&hist->buckets[min_t(unsigned int, bucket,
+					  TRIGGER5_HIST_BUCKETS - 1)]);
+}
+
+struct trigger5_stats {
+	atomic64_t frames_queued;
+	atomic64_t frames_transferred;
+	// Frames converted while an earlier frame was still on the wire
+	atomic64_t frames_overlapped;
+	// Commits that had to wait for a buffer to become free
+	atomic64_t ring_waits;
+	// Frames or snapshots replaced by a newer commit before going out
+	atomic64_t frames_coalesced;
+	atomic64_t frames_dropped;
+	atomic64_t rects_sent;
+	atomic64_t tiles_checked;
+	atomic64_t tiles_sent;
+	atomic64_t pll_cache_hits;
+	atomic64_t pll_cache_misses;
+	atomic64_t edid_cache_hits;
+	atomic64_t edid_cache_misses;
+	atomic64_t hpd_irqs;
+	atomic64_t frames_zero_copy;
+	atomic64_t buffer_allocs;
+	atomic64_t buffer_allocs_avoided;
+	atomic64_t bytes_sent;
+	atomic64_t urb_errors;
+	atomic64_t urb_timeouts;
+	// Frames with at least one URB cancelled by the timeout
+	atomic64_t frames_timed_out;
+	// Time the worker spent blocked waiting for a free buffer
+	atomic64_t ring_wait_ns;
+	struct trigger5_histogram convert_time;
+	struct trigger5_histogram transfer_time;
+	struct trigger5_histogram latency;
+};
+
+// Throughput over the last complete window, protected by queue_lock
+struct trigger5_rate {
+	u64 start;
+	unsigned int frames;
+	u64 bytes;
+	u64 window;
+	unsigned int last_frames;
+	u64 last_bytes;
+	// Time the link was busy with at least one frame, and its end
+	u64 busy;
+	u64 last_done;
+	// Frames replaced before going out
+	unsigned int coalesced;
+};
 
-	struct work_struct transfer_work;
-	struct completion frame_complete;
+enum trigger5_quality_level {
+	TRIGGER5_QUALITY_FULL,
+	TRIGGER5_QUALITY_REDUCED,
+	TRIGGER5_QUALITY_CAPPED,
+};
+
+// Adaptive quality controller state, updated under queue_lock
+struct trigger5_quality {
+	// Frame rate to hold, 0 leaves the controller off
+	unsigned int target_fps;
+	enum trigger5_quality_level level;
+	// Send 16 bpp on the wire
+	bool reduced;
+	// Emulated vblank rate while capped
+	unsigned int fps_cap;
+	// Throughput of the link while busy, in bytes per second
+	u64 link_rate;
+	// Consecutive windows agreeing on a step down or up
+	unsigned int congested;
+	unsigned int idle;
+};
+
+// Copy of the last frame sent, used to skip tiles that did not change
+struct trigger5_diff {
+	u8 *shadow;
+	unsigned long *dirty;
+	unsigned int width;
+	unsigned int height;
+	unsigned int pitch;
+	u32 format;
+	bool valid;
 };
 
 struct trigger5_pll {
@@ -62,6 +223,182 @@ struct trigger5_pll {
 	u8 div2;
 } __attribute__((packed));
 
+// Sets of the PLL cache, each holding a few clocks that hash alike
+#define TRIGGER5_PLL_CACHE_BITS	4
+#define TRIGGER5_PLL_CACHE_WAYS	4
+
+struct trigger5_pll_cache_entry {
+	int clock;
+	struct trigger5_pll pll;
+	u64 err;
+	// Lookup stamp of the last use, the oldest in a set is replaced
+	u32 used;
+};
+
+#define TRIGGER5_CURSOR_SIZE	64
+
+// The cursor as one commit left it
+struct trigger5_cursor_image {
+	// Visible part of the cursor, premultiplied ARGB8888
+	u32 data[TRIGGER5_CURSOR_SIZE * TRIGGER5_CURSOR_SIZE];
+	// Where the image lands in the primary framebuffer
+	struct drm_rect rect;
+	bool visible;
+	// Bumped by every cursor update, so an unchanged one is not copied
+	unsigned int seq;
+};
+
+/*
+ * One update of the screen. Damage from the primary plane goes through the
+ * diff, the regions a cursor move uncovers or covers are sent as they are.
+ */
+struct trigger5_snapshot {
+	// Referenced until the worker is done with it
+	struct drm_framebuffer *fb;
+	// Source of the primary plane at the time of the commit
+	struct drm_rect src;
+	struct drm_rect damage[TRIGGER5_MAX_DAMAGE_RECTS];
+	unsigned int num_damage;
+	struct drm_rect forced[TRIGGER5_MAX_DAMAGE_RECTS];
+	unsigned int num_forced;
+	struct drm_pending_vblank_event *event;
+	// Time the oldest commit merged into it started, in ns
+	u64 time;
+	// Composed on top, as of the newest commit merged into it
+	struct trigger5_cursor_image cursor;
+};
+
+/*
+ * Hand-off from the commit path to the per-device worker. A commit only
+ * fills in the pending snapshot and queues the worker. One that lands
+ * before the worker took the last snapshot merges its damage into it and
+ * replaces the framebuffer, so only the newest content goes out.
+ */
+struct trigger5_update {
+	struct kthread_work work;
+	// Protects pending, and swapping it with taken, against commits
+	spinlock_t lock;
+	struct trigger5_snapshot *pending;
+	// Snapshot being sent, owned by the worker
+	struct trigger5_snapshot *taken;
+	struct trigger5_snapshot snapshots[2];
+	// Last framebuffer sent, kept by the worker to resend the screen
+	struct drm_framebuffer *last_fb;
+	// Send the whole framebuffer with the next update
+	bool resend;
+};
+
+struct trigger5_cursor {
+	struct drm_plane plane;
+	// Only touched by commits, the worker composes a snapshot's copy
+	struct trigger5_cursor_image image;
+};
+
+// Time from the start of probe to each step of bring-up, 0 until reached
+struct trigger5_boot {
+	u64 start;
+	u64 probed;
+	u64 initialised;
+	u64 first_frame;
+};
+
+struct trigger5_converter {
+	const char *name;
+	// Vector kernels, return the number of pixels they converted
+	unsigned int (*xrgb8888_to_rgb888)(u8 *dst, const u8 *src,
+					   unsigned int pixels);
+	unsigned int (*xbgr8888_to_rgb888)(u8 *dst, const u8 *src,
+					   unsigned int pixels);
+	// Returns the leading bytes found equal, in whole steps of the kernel
+	unsigned int (*equal_bytes)(const u8 *a, const u8 *b,
+				    unsigned int len);
+};
+
+struct trigger5_device {
+	struct drm_device drm;
+	struct usb_interface *intf;
+	struct device *dmadev;
+
+	struct drm_connector connector;
+	// EDID of the connected monitor, dropped on disconnect
+	struct edid *edid;
+	enum drm_connector_status connector_status;
+	u8 *status_buf;
+	// Hotplug interrupt, NULL when the device has no interrupt endpoint
+	struct urb *hpd_urb;
+	// Consecutive failed reports, past a few the status is polled instead
+	unsigned int hpd_errors;
+	struct work_struct hpd_work;
+	struct delayed_work poll_work;
+	unsigned int poll_interval;
+	// Probing of the monitor and fbdev, off the USB enumeration path
+	struct work_struct init_work;
+	struct drm_simple_display_pipe display_pipe;
+
+	struct trigger5_mode_list mode_list;
+	const struct trigger5_converter *converter;
+	struct trigger5_pll_cache_entry pll_cache[1 << TRIGGER5_PLL_CACHE_BITS]
+						[TRIGGER5_PLL_CACHE_WAYS];
+	// Protects pll_cache and the stamp handed to its entries
+	spinlock_t pll_lock;
+	u32 pll_cache_stamp;
+	u16 frame_counter;
+	// Bits per pixel sent on the wire, 16 or 24, chosen at modeset
+	unsigned int wire_bpp;
+	// Depth the current mode has no variant for, 0 until one is missed
+	unsigned int missing_bpp;
+	// Per-device thread that converts and queues each update
+	struct kthread_worker *worker;
+	// Threads converting the other stripes of a large rectangle
+	struct kthread_worker *stripe_workers[TRIGGER5_MAX_STRIPES - 1];
+	unsigned int num_stripe_workers;
+	struct trigger5_update update;
+	// Mode set by the last enable, reprogrammed to switch depth
+	struct drm_display_mode mode;
+	bool enabled;
+	// Switches the wire depth, off the update worker
+	struct work_struct depth_work;
+	// Set while depth_work drains the ring, updates are held back
+	bool switching;
+	// No switch is tried before depth_retry after a failed drain
+	unsigned long depth_retry;
+	unsigned int depth_backoff_ms;
+	struct trigger5_cursor cursor;
+	// Emulated vblank at the refresh rate of the current mode
+	struct hrtimer vblank_timer;
+	ktime_t vblank_period;
+	u64 vblank_framedur_ns;
+	bool vblank_enabled;
+	struct trigger5_frame frames[TRIGGER5_NUM_FRAMES];
+	// Bulk buffer size that fits any damage of the largest mode
+	unsigned int max_frame_len;
+	// Next buffer to be filled by the worker
+	unsigned int fill_index;
+	// Next buffer to be split into URBs
+	unsigned int transfer_index;
+	// Number of filled buffers waiting for or in transfer
+	unsigned int queued;
+	// Number of filled buffers not yet completely submitted
+	unsigned int to_submit;
+	bool stopped;
+	spinlock_t queue_lock;
+
+	struct trigger5_urb *urbs;
+	unsigned int num_urbs;
+	unsigned long idle_urbs;
+	unsigned int urb_size;
+	unsigned int urb_max_sgs;
+	bool urb_sg;
+	bool zero_copy;
+	struct usb_anchor anchor;
+
+	struct trigger5_diff diff;
+	struct trigger5_stats stats;
+	struct trigger5_rate rate;
+	struct trigger5_quality quality;
+	struct trigger5_boot boot;
+};
+
 struct trigger6_mode_request {
 	__be16 height;
 	__be16 width;
@@ -82,27 +419,124 @@ struct trigger6_mode_request {
 	u8 vsync_polarity;
 } __attribute__((packed));
 
-struct trigger5_bulk_header {
-	u8 magic; //0xfb
-	u8 length; //0x14
-	__le16 counter; //12 bits
-	__le16 horizontal_offset;
-	__le16 vertical_offset;
-	__le16 width;
-	__le16 height;
-	__le32 payload_length; //upper 4 bits = 0x3
-	u8 flags; //0
-	u8 unknown1; //0
-	u8 unknown2; //0
-	u8 checksum;
-} __attribute__((packed));
-
 #define TRIGGER5_REQUEST_GET_MODE   0xA4
 #define TRIGGER5_REQUEST_GET_STATUS 0xA6
 #define TRIGGER5_REQUEST_GET_EDID   0xA8
 #define TRIGGER5_REQUEST_SET_MODE   0xC3
 
+// Back-off range of the status poll used without an interrupt endpoint
+#define TRIGGER5_POLL_MIN_MS	1000
+#define TRIGGER5_POLL_MAX_MS	30000
+
+// Back-off range of a depth switch whose drain failed
+#define TRIGGER5_DEPTH_RETRY_MIN_MS	1000
+#define TRIGGER5_DEPTH_RETRY_MAX_MS	60000
+
+// Failed interrupt reports in a row before falling back to polling
+#define TRIGGER5_HPD_MAX_ERRORS	8
+
 #define to_trigger5(x) container_of(x, struct trigger5_device, drm)
 
 int trigger5_connector_init(struct trigger5_device* trigger5, int connector_type);
+void trigger5_hpd_start(struct trigger5_device *trigger5);
+void trigger5_hpd_stop(struct trigger5_device *trigger5);
+
+unsigned int trigger5_merge_rects(struct drm_rect *rects, unsigned int count,
+				  unsigned int cpp);
+void trigger5_add_rect(struct drm_rect *rects, unsigned int *count,
+		       const struct drm_rect *rect);
+
+void trigger5_run_update(struct trigger5_device *trigger5,
+			 struct drm_framebuffer *fb,
+			 const struct drm_rect *rects, unsigned int num_rects,
+			 bool diff);
+void trigger5_release_update(struct trigger5_device *trigger5);
+
+int trigger5_cursor_init(struct trigger5_device *trigger5);
+void trigger5_cursor_compose(struct trigger5_device *trigger5,
+			     const struct trigger5_cursor_image *cursor,
+			     u8 *dst, const struct drm_rect *clip);
+
+int trigger5_diff_init(struct trigger5_device *trigger5);
+void trigger5_diff_invalidate(struct trigger5_device *trigger5);
+unsigned int trigger5_diff_rects(struct trigger5_device *trigger5,
+				 const struct drm_framebuffer *fb,
+				 const struct iosys_map *map,
+				 const struct drm_rect *src,
+				 struct drm_rect *rects, unsigned int num_rects);
+
+u8 trigger5_bulk_header_checksum(const struct trigger5_bulk_header *header);
+void trigger5_fill_bulk_header(struct trigger5_bulk_header *header,
+			       u16 counter, const struct drm_rect *rect,
+			       unsigned int payload_length);
+int trigger5_find_mode(const struct trigger5_mode_list *mode_list,
+		       const struct drm_display_mode *mode, unsigned int bpp);
+void trigger5_fill_mode_request(struct trigger6_mode_request *request,
+				const struct drm_display_mode *mode);
+enum drm_mode_status trigger5_pll_mode_status(u64 err, int clock);
+
+u64 trigger5_calculate_pll(struct trigger5_pll *pll, int clock);
+u64 trigger5_get_pll(struct trigger5_device *trigger5, struct trigger5_pll *pll,
+		     int clock);
+
+int trigger5_convert_init(struct trigger5_device *trigger5);
+void trigger5_convert_rect(struct trigger5_device *trigger5,
+			   struct iosys_map *dst, const struct iosys_map *src,
+			   const struct drm_framebuffer *fb,
+			   const struct drm_rect *rect);
+int trigger5_convert_bench_show(struct seq_file *m, void *unused);
+#if IS_ENABLED(CONFIG_KUNIT)
+void trigger5_convert_stripes(struct trigger5_device *trigger5, u8 *out,
+			      const u8 *vaddr,
+			      const struct drm_framebuffer *fb,
+			      const struct drm_rect *rect,
+			      unsigned int stripes);
+#endif
+int trigger5_convert_selftest(const struct trigger5_converter *converter);
+const struct trigger5_converter *trigger5_converter_get(unsigned int index);
+bool trigger5_simd_begin(void);
+void trigger5_simd_end(void);
+#ifdef CONFIG_ARM64
+unsigned int trigger5_xrgb8888_to_rgb888_neon(u8 *dst, const u8 *src,
+					      unsigned int pixels);
+unsigned int trigger5_xbgr8888_to_rgb888_neon(u8 *dst, const u8 *src,
+					      unsigned int pixels);
+unsigned int trigger5_equal_bytes_neon(const u8 *a, const u8 *b,
+				       unsigned int len);
+#endif
+
+#define TRIGGER5_SELFTEST_NUM_CLOCKS	72
+#define TRIGGER5_SELFTEST_NUM_MODES	3
+
+extern const int trigger5_selftest_clocks[TRIGGER5_SELFTEST_NUM_CLOCKS];
+extern const struct drm_display_mode
+	trigger5_selftest_modes[TRIGGER5_SELFTEST_NUM_MODES];
+s64 trigger5_bench_run(unsigned int index,
+		       const struct trigger5_mode_list *mode_list,
+		       const char **name);
+int trigger5_bench_show(struct seq_file *m, void *unused);
+
+int trigger5_alloc_bulk_buffer(struct trigger5_device *trigger5,
+			       struct trigger5_frame *frame, unsigned int len);
+void trigger5_free_bulk_buffer(struct trigger5_frame *frame);
+int trigger5_map_framebuffer(struct trigger5_frame *frame,
+			     struct drm_framebuffer *fb,
+			     const struct drm_rect *rect);
+void trigger5_release_framebuffer(struct trigger5_frame *frame);
+struct trigger5_frame *
+trigger5_begin_frame(struct trigger5_device *trigger5, struct sg_table *sgt,
+		     unsigned int len, struct drm_pending_vblank_event *event);
+void trigger5_frame_ready(struct trigger5_device *trigger5,
+			  struct trigger5_frame *frame, unsigned int ready);
+void trigger5_queue_frame(struct trigger5_device *trigger5,
+			  struct sg_table *sgt, unsigned int len,
+			  struct drm_pending_vblank_event *event);
+struct trigger5_frame *trigger5_reclaim_frame(struct trigger5_device *trigger5);
+int trigger5_transfer_init(struct trigger5_device *trigger5);
+void trigger5_transfer_stop(struct trigger5_device *trigger5);
+
+extern const struct attribute_group trigger5_quality_group;
+void trigger5_quality_update_locked(struct trigger5_device *trigger5);
+ktime_t trigger5_quality_vblank_period(struct trigger5_device *trigger5,
+				       u64 framedur_ns);
 #endif
\ No newline at end of file
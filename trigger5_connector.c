@@ -2,7 +2,9 @@
 #include <drm/drm_atomic_state_helper.h>
 #include <drm/drm_connector.h>
 #include <drm/drm_edid.h>
+#include <drm/drm_managed.h>
 #include <drm/drm_modeset_helper_vtables.h>
+#include <drm/drm_print.h>
 #include <drm/drm_probe_helper.h>
 
 #include "trigger5.h"
@@ -25,16 +27,29 @@ static int trigger5_read_edid(void *data, u8 *buf, unsigned int block,
 	return 0;
 }
 
+static void trigger5_invalidate_edid(struct trigger5_device *trigger5)
+{
+	kfree(trigger5->edid);
+	trigger5->edid = NULL;
+}
+
+/*
+ * The EDID only changes when a monitor is plugged in, so it is read once per
+ * connection and reused by every later probe.
+ */
 static int trigger5_connector_get_modes(struct drm_connector *connector)
 {
-	int ret;
 	struct trigger5_device *trigger5 = to_trigger5(connector->dev);
-	struct edid *edid;
-	edid = drm_do_get_edid(connector, trigger5_read_edid, trigger5);
-	drm_connector_update_edid_property(connector, edid);
-	ret = drm_add_edid_modes(connector, edid);
-	kfree(edid);
-	return ret;
+
+	if (trigger5->edid) {
+		atomic64_inc(&trigger5->stats.edid_cache_hits);
+	} else {
+		atomic64_inc(&trigger5->stats.edid_cache_misses);
+		trigger5->edid = drm_do_get_edid(connector, trigger5_read_edid,
+						 trigger5);
+	}
+	drm_connector_update_edid_property(connector, trigger5->edid);
+	return drm_add_edid_modes(connector, trigger5->edid);
 }
 
 static enum drm_connector_status
@@ -42,22 +57,29 @@ trigger5_detect(struct drm_connector *connector, bool force)
 {
 	struct trigger5_device *trigger5 = to_trigger5(connector->dev);
 	struct usb_device *udev = interface_to_usbdev(trigger5->intf);
-	u8 *status_buf = kmalloc(2, GFP_KERNEL);
 	int ret;
 	u8 status;
 
+	// Detection is serialised by the mode config mutex
 	ret = usb_control_msg(udev, usb_rcvctrlpipe(udev, 0),
 			      TRIGGER5_REQUEST_GET_STATUS,
 			      USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
-			      0xff, 0x3, status_buf, 2, USB_CTRL_GET_TIMEOUT);
-	status = status_buf[1];
-	kfree(status_buf);
+			      0xff, 0x3, trigger5->status_buf, 2,
+			      USB_CTRL_GET_TIMEOUT);
+	status = trigger5->status_buf[1];
 
 	if (ret < 0)
 		return connector_status_unknown;
 
-	return status == 1 ? connector_status_connected :
-			     connector_status_disconnected;
+	// A new connection may be a different monitor
+	if (status != 1 ||
+	    trigger5->connector_status != connector_status_connected)
+		trigger5_invalidate_edid(trigger5);
+	trigger5->connector_status = status == 1 ?
+					     connector_status_connected :
+					     connector_status_disconnected;
+
+	return trigger5->connector_status;
 }
 static const struct drm_connector_helper_funcs trigger5_connector_helper_funcs = {
 	.get_modes = trigger5_connector_get_modes,
@@ -72,15 +94,146 @@ static const struct drm_connector_funcs trigger5_connector_funcs = {
 	.atomic_destroy_state = drm_atomic_helper_connector_destroy_state,
 };
 
+static void trigger5_hpd_work(struct work_struct *work)
+{
+	struct trigger5_device *trigger5 =
+		container_of(work, struct trigger5_device, hpd_work);
+
+	drm_helper_hpd_irq_event(&trigger5->drm);
+}
+
+/*
+ * Any report on the interrupt endpoint means the status may have changed.
+ * Bit level errors may clear up on the next report, anything else, or too
+ * many in a row, hands detection over to the poll.
+ */
+static void trigger5_hpd_irq(struct urb *urb)
+{
+	struct trigger5_device *trigger5 = urb->context;
+
+	switch (urb->status) {
+	case 0:
+		trigger5->hpd_errors = 0;
+		atomic64_inc(&trigger5->stats.hpd_irqs);
+		schedule_work(&trigger5->hpd_work);
+		break;
+	case -ECONNRESET:
+	case -ENOENT:
+	case -ESHUTDOWN:
+		return;
+	case -EPROTO:
+	case -EILSEQ:
+	case -ETIME:
+	case -EOVERFLOW:
+		if (++trigger5->hpd_errors < TRIGGER5_HPD_MAX_ERRORS)
+			break;
+		fallthrough;
+	default:
+		drm_warn(&trigger5->drm,
+			 "hotplug interrupt failed: %d, polling instead\n",
+			 urb->status);
+		trigger5->poll_interval = TRIGGER5_POLL_MIN_MS;
+		schedule_delayed_work(&trigger5->poll_work,
+				      msecs_to_jiffies(TRIGGER5_POLL_MIN_MS));
+		return;
+	}
+
+	usb_submit_urb(urb, GFP_ATOMIC);
+}
+
+/*
+ * Without an interrupt endpoint the status is polled here instead of by the
+ * DRM poll worker, backing off while nothing changes.
+ */
+static void trigger5_poll_work(struct work_struct *work)
+{
+	struct trigger5_device *trigger5 = container_of(
+		to_delayed_work(work), struct trigger5_device, poll_work);
+
+	if (drm_helper_hpd_irq_event(&trigger5->drm))
+		trigger5->poll_interval = TRIGGER5_POLL_MIN_MS;
+	else
+		trigger5->poll_interval =
+			min_t(unsigned int, trigger5->poll_interval * 2,
+			      TRIGGER5_POLL_MAX_MS);
+
+	schedule_delayed_work(&trigger5->poll_work,
+			      msecs_to_jiffies(trigger5->poll_interval));
+}
+
+void trigger5_hpd_start(struct trigger5_device *trigger5)
+{
+	trigger5->hpd_errors = 0;
+	if (trigger5->hpd_urb) {
+		if (usb_submit_urb(trigger5->hpd_urb, GFP_KERNEL))
+			drm_warn(&trigger5->drm, "hotplug interrupt failed\n");
+		return;
+	}
+
+	trigger5->poll_interval = TRIGGER5_POLL_MIN_MS;
+	schedule_delayed_work(&trigger5->poll_work,
+			      msecs_to_jiffies(trigger5->poll_interval));
+}
+
+void trigger5_hpd_stop(struct trigger5_device *trigger5)
+{
+	usb_kill_urb(trigger5->hpd_urb);
+	cancel_delayed_work_sync(&trigger5->poll_work);
+	cancel_work_sync(&trigger5->hpd_work);
+}
+
+static void trigger5_connector_release(struct drm_device *dev, void *res)
+{
+	struct trigger5_device *trigger5 = to_trigger5(dev);
+
+	usb_free_urb(trigger5->hpd_urb);
+	trigger5_invalidate_edid(trigger5);
+}
+
+static int trigger5_hpd_init(struct trigger5_device *trigger5)
+{
+	struct usb_device *udev = interface_to_usbdev(trigger5->intf);
+	struct usb_endpoint_descriptor *ep;
+	u8 *buf;
+
+	INIT_WORK(&trigger5->hpd_work, trigger5_hpd_work);
+	INIT_DELAYED_WORK(&trigger5->poll_work, trigger5_poll_work);
+
+	if (usb_find_int_in_endpoint(trigger5->intf->cur_altsetting, &ep))
+		return 0;
+
+	buf = drmm_kmalloc(&trigger5->drm, usb_endpoint_maxp(ep), GFP_KERNEL);
+	trigger5->hpd_urb = usb_alloc_urb(0, GFP_KERNEL);
+	if (!buf || !trigger5->hpd_urb)
+		return -ENOMEM;
+
+	usb_fill_int_urb(trigger5->hpd_urb, udev,
+			 usb_rcvintpipe(udev, ep->bEndpointAddress), buf,
+			 usb_endpoint_maxp(ep), trigger5_hpd_irq, trigger5,
+			 ep->bInterval);
+	return 0;
+}
+
 int trigger5_connector_init(struct trigger5_device *trigger5,
 			    int connector_type)
 {
 	int ret;
+	trigger5->connector_status = connector_status_unknown;
+	ret = drmm_add_action_or_reset(&trigger5->drm,
+				       trigger5_connector_release, NULL);
+	if (ret)
+		return ret;
+	trigger5->status_buf = drmm_kmalloc(&trigger5->drm, 2, GFP_KERNEL);
+	if (!trigger5->status_buf)
+		return -ENOMEM;
+	ret = trigger5_hpd_init(trigger5);
+	if (ret)
+		return ret;
 	drm_connector_helper_add(&trigger5->connector,
 				 &trigger5_connector_helper_funcs);
 	ret = drm_connector_init(&trigger5->drm, &trigger5->connector,
 				 &trigger5_connector_funcs, connector_type);
-	trigger5->connector.polled =
-		DRM_CONNECTOR_POLL_CONNECT | DRM_CONNECTOR_POLL_DISCONNECT;
+	// Status changes are reported by trigger5_hpd_irq or trigger5_poll_work
+	trigger5->connector.polled = DRM_CONNECTOR_POLL_HPD;
 	return ret;
 }
\ No newline at end of file
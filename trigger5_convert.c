@@ -0,0 +1,745 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <kunit/visibility.h>
+#include <linux/cpumask.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
+#include <linux/vmalloc.h>
+
+#include <asm/unaligned.h>
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#endif
+#ifdef CONFIG_ARM64
+#include <asm/cpufeature.h>
+#include <asm/neon.h>
+#include <asm/simd.h>
+#endif
+
+#include <drm/drm_debugfs.h>
+#include <drm/drm_file.h>
+#include <drm/drm_format_helper.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_managed.h>
+#include <drm/drm_print.h>
+
+#include "trigger5.h"
+
+static bool dither = true;
+module_param(dither, bool, 0644);
+MODULE_PARM_DESC(dither, "Ordered dithering for 16 bpp output (default true)");
+
+static unsigned int parallel_threshold = SZ_1M;
+module_param(parallel_threshold, uint, 0644);
+MODULE_PARM_DESC(parallel_threshold, "Source bytes from which a rectangle is converted on several CPUs, 0 to disable (default 1048576)");
+
+static unsigned int parallel_stripes = 4;
+module_param(parallel_stripes, uint, 0644);
+MODULE_PARM_DESC(parallel_stripes, "Most stripes a rectangle is split into (default 4, at most 8)");
+
+
+// 4x4 Bayer matrix, thresholds 0-15
+static const u8 trigger5_bayer[4][4] = {
+	{ 0, 8, 2, 10 },
+	{ 12, 4, 14, 6 },
+	{ 3, 11, 1, 9 },
+	{ 15, 7, 13, 5 },
+};
+
+/*
+ * XRGB8888 is stored as B, G, R, X in memory and the device takes B, G, R,
+ * so the conversion drops every fourth byte. The vector kernels convert the
+ * bulk of a line and return how many pixels they did, the scalar loop
+ * finishes the rest.
+ */
+static void trigger5_xrgb8888_to_rgb888_scalar(u8 *dst, const u8 *src,
+					       unsigned int pixels)
+{
+	unsigned int x;
+
+	for (x = 0; x < pixels; x++) {
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+		dst += 3;
+		src += 4;
+	}
+}
+
+// XBGR8888 is stored R, G, B, X, so red and blue also swap places
+static void trigger5_xbgr8888_to_rgb888_scalar(u8 *dst, const u8 *src,
+					       unsigned int pixels)
+{
+	unsigned int x;
+
+	for (x = 0; x < pixels; x++) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+		dst += 3;
+		src += 4;
+	}
+}
+
+// Widen each channel by repeating its top bits, so white stays white
+static void trigger5_rgb565_to_rgb888_line(u8 *dst, const u8 *src,
+					   unsigned int pixels)
+{
+	unsigned int x, pixel;
+
+	for (x = 0; x < pixels; x++) {
+		pixel = get_unaligned_le16(src);
+		dst[0] = ((pixel & 0x1f) << 3) | ((pixel >> 2) & 7);
+		dst[1] = ((pixel >> 3) & 0xfc) | ((pixel >> 9) & 3);
+		dst[2] = ((pixel >> 11) << 3) | (pixel >> 13);
+		dst += 3;
+		src += 2;
+	}
+}
+
+/*
+ * Packs sources of cpp bytes per pixel with red at byte red and blue at
+ * byte 2 - red, green always in the middle. The threshold is
+ * scaled to the bits each channel loses, 3 for red and blue and 2 for green,
+ * and indexed by screen position so a static image keeps a stable pattern
+ * between updates.
+ */
+static void trigger5_to_rgb565_line(u8 *dst, const u8 *src, unsigned int cpp,
+				    unsigned int red, unsigned int pixels,
+				    unsigned int x, unsigned int y)
+{
+	const u8 *bayer = trigger5_bayer[y & 3];
+	unsigned int i, r, g, b, d;
+
+	for (i = 0; i < pixels; i++, x++) {
+		b = src[2 - red];
+		g = src[1];
+		r = src[red];
+		if (dither) {
+			d = bayer[x & 3];
+			b = min(b + (d >> 1), 255U);
+			g = min(g + (d >> 2), 255U);
+			r = min(r + (d >> 1), 255U);
+		}
+		put_unaligned_le16(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3),
+				   dst);
+		dst += 2;
+		src += cpp;
+	}
+}
+
+#ifdef CONFIG_X86
+static const u8 trigger5_rgb888_shuffle[32] __aligned(32) = {
+	0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0x80, 0x80, 0x80, 0x80,
+	0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0x80, 0x80, 0x80, 0x80,
+};
+
+// Same packing with red and blue swapped, for XBGR8888
+static const u8 trigger5_bgr888_shuffle[32] __aligned(32) = {
+	2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, 0x80, 0x80, 0x80, 0x80,
+	2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, 0x80, 0x80, 0x80, 0x80,
+};
+
+// Dword order packing the two 12 byte lanes of a ymm register together
+static const u32 trigger5_rgb888_permute[8] __aligned(32) = {
+	0, 1, 2, 4, 5, 6, 3, 7,
+};
+
+static unsigned int trigger5_shuffle_to_rgb888_ssse3(u8 *dst, const u8 *src,
+						     unsigned int pixels,
+						     const u8 *shuffle)
+{
+	unsigned int done = 0;
+
+	asm volatile("movdqa %0, %%xmm7" : : "m"(*(const u8(*)[16])shuffle));
+
+	// 16 pixels in, three full 16 byte stores out
+	for (; done + 16 <= pixels; done += 16, src += 64, dst += 48) {
+		asm volatile("movdqu 0(%[src]), %%xmm0\n\t"
+			     "movdqu 16(%[src]), %%xmm1\n\t"
+			     "movdqu 32(%[src]), %%xmm2\n\t"
+			     "movdqu 48(%[src]), %%xmm3\n\t"
+			     "pshufb %%xmm7, %%xmm0\n\t"
+			     "pshufb %%xmm7, %%xmm1\n\t"
+			     "pshufb %%xmm7, %%xmm2\n\t"
+			     "pshufb %%xmm7, %%xmm3\n\t"
+			     "movdqa %%xmm1, %%xmm4\n\t"
+			     "pslldq $12, %%xmm4\n\t"
+			     "por %%xmm4, %%xmm0\n\t"
+			     "psrldq $4, %%xmm1\n\t"
+			     "movdqa %%xmm2, %%xmm4\n\t"
+			     "pslldq $8, %%xmm4\n\t"
+			     "por %%xmm4, %%xmm1\n\t"
+			     "psrldq $8, %%xmm2\n\t"
+			     "pslldq $4, %%xmm3\n\t"
+			     "por %%xmm3, %%xmm2\n\t"
+			     "movdqu %%xmm0, 0(%[dst])\n\t"
+			     "movdqu %%xmm1, 16(%[dst])\n\t"
+			     "movdqu %%xmm2, 32(%[dst])\n\t"
+			     :
+			     : [src] "r"(src), [dst] "r"(dst)
+			     : "memory");
+	}
+
+	return done;
+}
+
+static unsigned int trigger5_shuffle_to_rgb888_avx2(u8 *dst, const u8 *src,
+						    unsigned int pixels,
+						    const u8 *shuffle)
+{
+	unsigned int done = 0;
+
+	asm volatile("vmovdqa %0, %%ymm7\n\t"
+		     "vmovdqa %1, %%ymm6"
+		     :
+		     : "m"(*(const u8(*)[32])shuffle),
+		       "m"(trigger5_rgb888_permute));
+
+	/*
+	 * 8 pixels in, 24 bytes out through a 32 byte store. The excess is
+	 * overwritten by the next store, so stop while 32 bytes still fit.
+	 */
+	for (; done + 11 <= pixels; done += 8, src += 32, dst += 24) {
+		asm volatile("vmovdqu (%[src]), %%ymm0\n\t"
+			     "vpshufb %%ymm7, %%ymm0, %%ymm0\n\t"
+			     "vpermd %%ymm0, %%ymm6, %%ymm0\n\t"
+			     "vmovdqu %%ymm0, (%[dst])\n\t"
+			     :
+			     : [src] "r"(src), [dst] "r"(dst)
+			     : "memory");
+	}
+	asm volatile("vzeroupper");
+
+	return done;
+}
+
+// Compare 64 bytes a step, stopping at the first step with a difference
+static unsigned int trigger5_equal_bytes_sse2(const u8 *a, const u8 *b,
+					      unsigned int len)
+{
+	unsigned int done = 0, mask;
+
+	for (; done + 64 <= len; done += 64, a += 64, b += 64) {
+		asm volatile("movdqu 0(%[a]), %%xmm0\n\t"
+			     "movdqu 16(%[a]), %%xmm1\n\t"
+			     "movdqu 32(%[a]), %%xmm2\n\t"
+			     "movdqu 48(%[a]), %%xmm3\n\t"
+			     "movdqu 0(%[b]), %%xmm4\n\t"
+			     "movdqu 16(%[b]), %%xmm5\n\t"
+			     "movdqu 32(%[b]), %%xmm6\n\t"
+			     "movdqu 48(%[b]), %%xmm7\n\t"
+			     "pcmpeqb %%xmm4, %%xmm0\n\t"
+			     "pcmpeqb %%xmm5, %%xmm1\n\t"
+			     "pcmpeqb %%xmm6, %%xmm2\n\t"
+			     "pcmpeqb %%xmm7, %%xmm3\n\t"
+			     "pand %%xmm1, %%xmm0\n\t"
+			     "pand %%xmm3, %%xmm2\n\t"
+			     "pand %%xmm2, %%xmm0\n\t"
+			     "pmovmskb %%xmm0, %[mask]\n\t"
+			     : [mask] "=r"(mask)
+			     : [a] "r"(a), [b] "r"(b)
+			     : "memory");
+		if (mask != 0xffff)
+			break;
+	}
+
+	return done;
+}
+
+static unsigned int trigger5_equal_bytes_avx2(const u8 *a, const u8 *b,
+					      unsigned int len)
+{
+	unsigned int done = 0, mask;
+
+	for (; done + 64 <= len; done += 64, a += 64, b += 64) {
+		asm volatile("vmovdqu 0(%[a]), %%ymm0\n\t"
+			     "vmovdqu 32(%[a]), %%ymm1\n\t"
+			     "vpcmpeqb 0(%[b]), %%ymm0, %%ymm0\n\t"
+			     "vpcmpeqb 32(%[b]), %%ymm1, %%ymm1\n\t"
+			     "vpand %%ymm1, %%ymm0, %%ymm0\n\t"
+			     "vpmovmskb %%ymm0, %[mask]\n\t"
+			     : [mask] "=r"(mask)
+			     : [a] "r"(a), [b] "r"(b)
+			     : "memory");
+		if (mask != 0xffffffff)
+			break;
+	}
+	asm volatile("vzeroupper");
+
+	return done;
+}
+
+static unsigned int trigger5_xrgb8888_to_rgb888_ssse3(u8 *dst, const u8 *src,
+						      unsigned int pixels)
+{
+	return trigger5_shuffle_to_rgb888_ssse3(dst, src, pixels,
+						trigger5_rgb888_shuffle);
+}
+
+static unsigned int trigger5_xbgr8888_to_rgb888_ssse3(u8 *dst, const u8 *src,
+						      unsigned int pixels)
+{
+	return trigger5_shuffle_to_rgb888_ssse3(dst, src, pixels,
+						trigger5_bgr888_shuffle);
+}
+
+static unsigned int trigger5_xrgb8888_to_rgb888_avx2(u8 *dst, const u8 *src,
+						     unsigned int pixels)
+{
+	return trigger5_shuffle_to_rgb888_avx2(dst, src, pixels,
+					       trigger5_rgb888_shuffle);
+}
+
+static unsigned int trigger5_xbgr8888_to_rgb888_avx2(u8 *dst, const u8 *src,
+						     unsigned int pixels)
+{
+	return trigger5_shuffle_to_rgb888_avx2(dst, src, pixels,
+					       trigger5_bgr888_shuffle);
+}
+#endif
+
+static const struct trigger5_converter trigger5_converter_scalar = {
+	.name = "scalar",
+};
+
+#ifdef CONFIG_X86
+static const struct trigger5_converter trigger5_converter_ssse3 = {
+	.name = "ssse3",
+	.xrgb8888_to_rgb888 = trigger5_xrgb8888_to_rgb888_ssse3,
+	.xbgr8888_to_rgb888 = trigger5_xbgr8888_to_rgb888_ssse3,
+	.equal_bytes = trigger5_equal_bytes_sse2,
+};
+
+static const struct trigger5_converter trigger5_converter_avx2 = {
+	.name = "avx2",
+	.xrgb8888_to_rgb888 = trigger5_xrgb8888_to_rgb888_avx2,
+	.xbgr8888_to_rgb888 = trigger5_xbgr8888_to_rgb888_avx2,
+	.equal_bytes = trigger5_equal_bytes_avx2,
+};
+#endif
+
+#ifdef CONFIG_ARM64
+static const struct trigger5_converter trigger5_converter_neon = {
+	.name = "neon",
+	.xrgb8888_to_rgb888 = trigger5_xrgb8888_to_rgb888_neon,
+	.xbgr8888_to_rgb888 = trigger5_xbgr8888_to_rgb888_neon,
+	.equal_bytes = trigger5_equal_bytes_neon,
+};
+#endif
+
+// Best first, the scalar fallback runs everywhere
+static const struct trigger5_converter *const trigger5_converters[] = {
+#ifdef CONFIG_X86
+	&trigger5_converter_avx2,
+	&trigger5_converter_ssse3,
+#endif
+#ifdef CONFIG_ARM64
+	&trigger5_converter_neon,
+#endif
+	&trigger5_converter_scalar,
+};
+
+static bool
+trigger5_converter_usable(const struct trigger5_converter *converter)
+{
+#ifdef CONFIG_X86
+	if (converter == &trigger5_converter_avx2)
+		return boot_cpu_has(X86_FEATURE_AVX2) &&
+		       cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM,
+					 NULL);
+	if (converter == &trigger5_converter_ssse3)
+		return boot_cpu_has(X86_FEATURE_SSSE3);
+#endif
+#ifdef CONFIG_ARM64
+	if (converter == &trigger5_converter_neon)
+		return cpu_have_named_feature(ASIMD);
+#endif
+	return true;
+}
+
+/*
+ * Return the index-th converter this CPU can run, best first, or NULL past
+ * the last one. The scalar converter is always the last.
+ */
+const struct trigger5_converter *trigger5_converter_get(unsigned int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(trigger5_converters); i++)
+		if (trigger5_converter_usable(trigger5_converters[i]) &&
+		    !index--)
+			return trigger5_converters[i];
+
+	return NULL;
+}
+
+// Claim the vector unit, false where it can't be used from here
+bool trigger5_simd_begin(void)
+{
+#if defined(CONFIG_X86)
+	if (!irq_fpu_usable())
+		return false;
+	kernel_fpu_begin();
+	return true;
+#elif defined(CONFIG_ARM64)
+	if (!may_use_simd())
+		return false;
+	kernel_neon_begin();
+	return true;
+#else
+	return false;
+#endif
+}
+
+void trigger5_simd_end(void)
+{
+#if defined(CONFIG_X86)
+	kernel_fpu_end();
+#elif defined(CONFIG_ARM64)
+	kernel_neon_end();
+#endif
+}
+
+// 32 bpp to RGB888, bgr selecting the XBGR8888 byte order
+static void trigger5_convert_line(const struct trigger5_converter *converter,
+				  u8 *dst, const u8 *src, unsigned int pixels,
+				  bool bgr)
+{
+	unsigned int (*kernel)(u8 *dst, const u8 *src, unsigned int pixels) =
+		bgr ? converter->xbgr8888_to_rgb888 :
+		      converter->xrgb8888_to_rgb888;
+	unsigned int done = 0;
+
+	// The vector unit is claimed per line to keep preemption latency low
+	if (kernel && trigger5_simd_begin()) {
+		done = kernel(dst, src, pixels);
+		trigger5_simd_end();
+	}
+	if (bgr)
+		trigger5_xbgr8888_to_rgb888_scalar(dst + done * 3,
+						   src + done * 4,
+						   pixels - done);
+	else
+		trigger5_xrgb8888_to_rgb888_scalar(dst + done * 3,
+						   src + done * 4,
+						   pixels - done);
+}
+
+// Convert one line of any supported format into the wire format
+static void trigger5_convert_format_line(struct trigger5_device *trigger5,
+					 u8 *out, const u8 *vaddr,
+					 const struct drm_format_info *format,
+					 unsigned int width, unsigned int x,
+					 unsigned int y)
+{
+	bool wire16 = trigger5->wire_bpp == 16;
+
+	switch (format->format) {
+	case DRM_FORMAT_RGB565:
+		if (wire16)
+			memcpy(out, vaddr, width * 2);
+		else
+			trigger5_rgb565_to_rgb888_line(out, vaddr, width);
+		break;
+	case DRM_FORMAT_RGB888:
+		if (wire16)
+			trigger5_to_rgb565_line(out, vaddr, 3, 2, width, x, y);
+		else
+			memcpy(out, vaddr, width * 3);
+		break;
+	case DRM_FORMAT_XBGR8888:
+	case DRM_FORMAT_ABGR8888:
+		if (wire16)
+			trigger5_to_rgb565_line(out, vaddr, 4, 0, width, x, y);
+		else
+			trigger5_convert_line(trigger5->converter, out, vaddr,
+					      width, true);
+		break;
+	default:
+		// XRGB8888 and ARGB8888, alpha is ignored on the primary plane
+		if (wire16)
+			trigger5_to_rgb565_line(out, vaddr, 4, 2, width, x, y);
+		else
+			trigger5_convert_line(trigger5->converter, out, vaddr,
+					      width, false);
+		break;
+	}
+}
+
+static void trigger5_convert_lines(struct trigger5_device *trigger5, u8 *out,
+				   const u8 *vaddr,
+				   const struct drm_framebuffer *fb,
+				   const struct drm_rect *rect)
+{
+	unsigned int width = drm_rect_width(rect);
+	unsigned int out_pitch = width * trigger5->wire_bpp / 8;
+	int y;
+
+	for (y = rect->y1; y < rect->y2; y++) {
+		trigger5_convert_format_line(trigger5, out, vaddr, fb->format,
+					     width, rect->x1, y);
+		out += out_pitch;
+		vaddr += fb->pitches[0];
+	}
+}
+
+struct trigger5_stripe {
+	struct kthread_work work;
+	struct trigger5_device *trigger5;
+	u8 *out;
+	const u8 *vaddr;
+	const struct drm_framebuffer *fb;
+	struct drm_rect rect;
+};
+
+static void trigger5_stripe_work(struct kthread_work *work)
+{
+	struct trigger5_stripe *stripe =
+		container_of(work, struct trigger5_stripe, work);
+
+	trigger5_convert_lines(stripe->trigger5, stripe->out, stripe->vaddr,
+			       stripe->fb, &stripe->rect);
+}
+
+/*
+ * Split the rectangle into horizontal stripes and convert them on the
+ * stripe workers, doing the first one on the calling thread. Returns once
+ * every stripe is done.
+ */
+VISIBLE_IF_KUNIT void
+trigger5_convert_stripes(struct trigger5_device *trigger5, u8 *out,
+			 const u8 *vaddr, const struct drm_framebuffer *fb,
+			 const struct drm_rect *rect, unsigned int stripes)
+{
+	struct trigger5_stripe stripe[TRIGGER5_MAX_STRIPES];
+	unsigned int height = drm_rect_height(rect);
+	unsigned int out_pitch = drm_rect_width(rect) * trigger5->wire_bpp / 8;
+	unsigned int i, rows, y = 0;
+
+	for (i = 0; i < stripes; i++) {
+		rows = height / stripes + (i < height % stripes);
+		stripe[i].trigger5 = trigger5;
+		stripe[i].out = out + y * out_pitch;
+		stripe[i].vaddr = vaddr + y * fb->pitches[0];
+		stripe[i].fb = fb;
+		drm_rect_init(&stripe[i].rect, rect->x1, rect->y1 + y,
+			      drm_rect_width(rect), rows);
+		y += rows;
+	}
+
+	for (i = 1; i < stripes; i++) {
+		kthread_init_work(&stripe[i].work, trigger5_stripe_work);
+		kthread_queue_work(trigger5->stripe_workers[i - 1],
+				   &stripe[i].work);
+	}
+
+	trigger5_convert_lines(trigger5, stripe[0].out, stripe[0].vaddr, fb,
+			       &stripe[0].rect);
+
+	for (i = 1; i < stripes; i++)
+		kthread_flush_work(&stripe[i].work);
+}
+
+static unsigned int
+trigger5_convert_num_stripes(struct trigger5_device *trigger5,
+			     const struct drm_rect *rect, unsigned int cpp)
+{
+	unsigned int bytes = drm_rect_width(rect) * drm_rect_height(rect) * cpp;
+	unsigned int stripes;
+
+	if (!parallel_threshold || bytes < parallel_threshold)
+		return 1;
+
+	stripes = min3(parallel_stripes, num_online_cpus(),
+		       trigger5->num_stripe_workers + 1);
+	return clamp_t(unsigned int, stripes, 1, drm_rect_height(rect));
+}
+
+/*
+ * Convert one rectangle of the framebuffer into the wire format. RGB888 and
+ * RGB565 framebuffers already match the 24 and 16 bpp wire formats and are
+ * copied. Large rectangles are spread over several CPUs.
+ */
+void trigger5_convert_rect(struct trigger5_device *trigger5,
+			   struct iosys_map *dst, const struct iosys_map *src,
+			   const struct drm_framebuffer *fb,
+			   const struct drm_rect *rect)
+{
+	unsigned int cpp = fb->format->cpp[0];
+	unsigned int stripes;
+	const u8 *vaddr;
+
+	if (src->is_iomem || dst->is_iomem) {
+		drm_fb_blit(dst, NULL,
+			    trigger5->wire_bpp == 16 ? DRM_FORMAT_RGB565 :
+						       DRM_FORMAT_RGB888,
+			    src, fb, rect);
+		return;
+	}
+
+	vaddr = src->vaddr + rect->y1 * fb->pitches[0] + rect->x1 * cpp;
+	stripes = trigger5_convert_num_stripes(trigger5, rect, cpp);
+	if (stripes > 1)
+		trigger5_convert_stripes(trigger5, dst->vaddr, vaddr, fb, rect,
+					 stripes);
+	else
+		trigger5_convert_lines(trigger5, dst->vaddr, vaddr, fb, rect);
+}
+
+/*
+ * Time a full 1080p conversion at each stripe count up to the number of
+ * CPUs, to see how conversion latency scales.
+ */
+int trigger5_convert_bench_show(struct seq_file *m, void *unused)
+{
+	struct drm_info_node *node = m->private;
+	struct trigger5_device *trigger5 = to_trigger5(node->minor->dev);
+	const unsigned int width = 1920, height = 1080, runs = 8;
+	struct drm_framebuffer fb = {
+		.format = drm_format_info(DRM_FORMAT_XRGB8888),
+		.pitches = { width * 4 },
+		.width = width,
+		.height = height,
+	};
+	struct drm_rect rect = DRM_RECT_INIT(0, 0, width, height);
+	unsigned int stripes, max_stripes, i;
+	u64 start, best;
+	u8 *src, *out;
+	int ret = 0;
+
+	src = vmalloc(width * height * 4);
+	out = vmalloc(width * height * 3);
+	if (!src || !out) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	get_random_bytes(src, width * height * 4);
+
+	max_stripes = min(num_online_cpus(), trigger5->num_stripe_workers + 1);
+	seq_printf(m, "%ux%u XRGB8888 to %u bpp, %s, best of %u\n", width,
+		   height, trigger5->wire_bpp, trigger5->converter->name, runs);
+	for (stripes = 1; stripes <= max_stripes; stripes *= 2) {
+		best = U64_MAX;
+		for (i = 0; i < runs; i++) {
+			start = ktime_get_ns();
+			if (stripes > 1)
+				trigger5_convert_stripes(trigger5, out, src,
+							 &fb, &rect, stripes);
+			else
+				trigger5_convert_lines(trigger5, out, src, &fb,
+						       &rect);
+			best = min(best, ktime_get_ns() - start);
+		}
+		seq_printf(m, "stripes %2u: %6llu us\n", stripes,
+			   div_u64(best, NSEC_PER_USEC));
+	}
+
+out_free:
+	vfree(out);
+	vfree(src);
+	return ret;
+}
+
+/*
+ * Check the selected kernels byte for byte against the generic DRM helper
+ * and the scalar swap, with odd sizes so every tail path is exercised, and
+ * make sure the compare kernel catches a change in any byte.
+ */
+int trigger5_convert_selftest(const struct trigger5_converter *converter)
+{
+	const unsigned int width = 67, height = 3;
+	struct drm_framebuffer fb = {
+		.format = drm_format_info(DRM_FORMAT_XRGB8888),
+		.pitches = { width * 4 },
+		.width = width,
+		.height = height,
+	};
+	struct drm_rect rect = DRM_RECT_INIT(0, 0, width, height);
+	struct iosys_map src_map, ref_map;
+	u8 *src, *ref, *out;
+	unsigned int y, x, len, done;
+	int ret = 0;
+
+	src = kmalloc(width * height * 4, GFP_KERNEL);
+	ref = kmalloc(width * height * 3, GFP_KERNEL);
+	out = kmalloc(width * height * 3, GFP_KERNEL);
+	if (!src || !ref || !out) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	get_random_bytes(src, width * height * 4);
+	iosys_map_set_vaddr(&src_map, src);
+	iosys_map_set_vaddr(&ref_map, ref);
+	drm_fb_xrgb8888_to_rgb888(&ref_map, NULL, &src_map, &fb, &rect);
+
+	for (y = 0; y < height; y++)
+		trigger5_convert_line(converter, out + y * width * 3,
+				      src + y * width * 4, width - y, false);
+	for (y = 0; y < height; y++) {
+		if (memcmp(out + y * width * 3, ref + y * width * 3,
+			   (width - y) * 3)) {
+			ret = -EINVAL;
+			goto out_free;
+		}
+	}
+
+	// Swapping red and blue in the reference gives the XBGR8888 result
+	for (x = 0; x < width * height; x++)
+		swap(ref[x * 3], ref[x * 3 + 2]);
+	for (y = 0; y < height; y++)
+		trigger5_convert_line(converter, out + y * width * 3,
+				      src + y * width * 4, width - y, true);
+	for (y = 0; y < height; y++) {
+		if (memcmp(out + y * width * 3, ref + y * width * 3,
+			   (width - y) * 3)) {
+			ret = -EINVAL;
+			break;
+		}
+	}
+
+	// The compare kernel must stop at or before any byte that differs
+	if (!ret && converter->equal_bytes && trigger5_simd_begin()) {
+		len = width * 4;
+		memcpy(src + len, src, len);
+		done = converter->equal_bytes(src, src + len, len);
+		if (done > len || done + 64 < len)
+			ret = -EINVAL;
+		for (x = 0; x < len && !ret; x++) {
+			src[len + x] ^= 0x10;
+			if (converter->equal_bytes(src, src + len, len) > x)
+				ret = -EINVAL;
+			src[len + x] ^= 0x10;
+		}
+		trigger5_simd_end();
+	}
+
+out_free:
+	kfree(out);
+	kfree(ref);
+	kfree(src);
+	return ret;
+}
+
+int trigger5_convert_init(struct trigger5_device *trigger5)
+{
+	const struct trigger5_converter *converter = trigger5_converter_get(0);
+
+	if (converter != &trigger5_converter_scalar &&
+	    trigger5_convert_selftest(converter)) {
+		drm_warn(&trigger5->drm,
+			 "%s conversion failed self-test, using scalar\n",
+			 converter->name);
+		converter = &trigger5_converter_scalar;
+	}
+
+	drm_dbg(&trigger5->drm, "using %s pixel conversion\n", converter->name);
+	trigger5->converter = converter;
+
+	return 0;
+}
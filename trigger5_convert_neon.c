@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <asm/neon-intrinsics.h>
+
+#include "trigger5.h"
+
+// De-interleave 16 pixels into B, G, R, X planes and store B, G, R back
+unsigned int trigger5_xrgb8888_to_rgb888_neon(u8 *dst, const u8 *src,
+					      unsigned int pixels)
+{
+	unsigned int done = 0;
+	uint8x16x4_t in;
+	uint8x16x3_t out;
+
+	for (; done + 16 <= pixels; done += 16, src += 64, dst += 48) {
+		in = vld4q_u8(src);
+		out.val[0] = in.val[0];
+		out.val[1] = in.val[1];
+		out.val[2] = in.val[2];
+		vst3q_u8(dst, out);
+	}
+
+	return done;
+}
+
+// Same with red and blue swapped, for XBGR8888
+unsigned int trigger5_xbgr8888_to_rgb888_neon(u8 *dst, const u8 *src,
+					      unsigned int pixels)
+{
+	unsigned int done = 0;
+	uint8x16x4_t in;
+	uint8x16x3_t out;
+
+	for (; done + 16 <= pixels; done += 16, src += 64, dst += 48) {
+		in = vld4q_u8(src);
+		out.val[0] = in.val[2];
+		out.val[1] = in.val[1];
+		out.val[2] = in.val[0];
+		vst3q_u8(dst, out);
+	}
+
+	return done;
+}
+
+// Compare 64 bytes a step, stopping at the first step with a difference
+unsigned int trigger5_equal_bytes_neon(const u8 *a, const u8 *b,
+				       unsigned int len)
+{
+	unsigned int done = 0;
+	uint8x16_t eq;
+
+	for (; done + 64 <= len; done += 64, a += 64, b += 64) {
+		eq = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(a), vld1q_u8(b)),
+				       vceqq_u8(vld1q_u8(a + 16),
+						vld1q_u8(b + 16))),
+			      vandq_u8(vceqq_u8(vld1q_u8(a + 32),
+						vld1q_u8(b + 32)),
+				       vceqq_u8(vld1q_u8(a + 48),
+						vld1q_u8(b + 48))));
+		if (vminvq_u8(eq) != 0xff)
+			break;
+	}
+
+	return done;
+}
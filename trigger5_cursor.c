@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/string.h>
+
+#include <asm/unaligned.h>
+
+#include <drm/drm_atomic.h>
+#include <drm/drm_atomic_helper.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_gem_atomic_helper.h>
+#include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/drm_plane.h>
+
+#include "trigger5.h"
+
+/*
+ * The device has a single framebuffer and no hardware cursor. Exposing a
+ * cursor plane anyway keeps the compositor from redrawing the primary plane
+ * on every mouse move: the cursor is blended into the converted rows here,
+ * and a move only resends the rectangles it left and entered.
+ */
+
+static const uint32_t trigger5_cursor_formats[] = {
+	DRM_FORMAT_ARGB8888,
+};
+
+// Premultiplied over, on one channel
+static u8 trigger5_cursor_over(unsigned int src, unsigned int dst,
+			       unsigned int inv_alpha)
+{
+	return src + (dst * inv_alpha + 127) / 255;
+}
+
+static void trigger5_cursor_blend(u8 *out, u32 argb, unsigned int cpp)
+{
+	unsigned int inv_alpha = 255 - (argb >> 24);
+	unsigned int r = (argb >> 16) & 0xff;
+	unsigned int g = (argb >> 8) & 0xff;
+	unsigned int b = argb & 0xff;
+	unsigned int pixel;
+
+	if (inv_alpha == 255 && !(argb & 0xffffff))
+		return;
+
+	if (cpp == 3) {
+		// Wire RGB888 is stored B, G, R
+		out[0] = trigger5_cursor_over(b, out[0], inv_alpha);
+		out[1] = trigger5_cursor_over(g, out[1], inv_alpha);
+		out[2] = trigger5_cursor_over(r, out[2], inv_alpha);
+		return;
+	}
+
+	pixel = get_unaligned_le16(out);
+	r = trigger5_cursor_over(r, ((pixel >> 11) << 3) | (pixel >> 13),
+				 inv_alpha);
+	g = trigger5_cursor_over(g, ((pixel >> 3) & 0xfc) | ((pixel >> 9) & 3),
+				 inv_alpha);
+	b = trigger5_cursor_over(b, ((pixel & 0x1f) << 3) | ((pixel >> 2) & 7),
+				 inv_alpha);
+	put_unaligned_le16(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3), out);
+}
+
+/*
+ * Blend a snapshot's cursor into rows already converted to the wire
+ * format. dst holds the pixels of clip, packed with no padding between
+ * rows.
+ */
+void trigger5_cursor_compose(struct trigger5_device *trigger5,
+			     const struct trigger5_cursor_image *cursor,
+			     u8 *dst, const struct drm_rect *clip)
+{
+	unsigned int cpp = trigger5->wire_bpp / 8;
+	unsigned int pitch = drm_rect_width(clip) * cpp;
+	struct drm_rect area = cursor->rect;
+	const u32 *src;
+	u8 *out;
+	int x, y;
+
+	if (!cursor->visible || !drm_rect_intersect(&area, clip))
+		return;
+
+	for (y = area.y1; y < area.y2; y++) {
+		src = &cursor->data[(y - cursor->rect.y1) *
+					     TRIGGER5_CURSOR_SIZE +
+				     area.x1 - cursor->rect.x1];
+		out = dst + (y - clip->y1) * pitch + (area.x1 - clip->x1) * cpp;
+		for (x = area.x1; x < area.x2; x++, out += cpp)
+			trigger5_cursor_blend(out, *src++, cpp);
+	}
+}
+
+static int trigger5_cursor_atomic_check(struct drm_plane *plane,
+					struct drm_atomic_state *state)
+{
+	struct drm_plane_state *new_state =
+		drm_atomic_get_new_plane_state(state, plane);
+	struct drm_crtc_state *crtc_state = NULL;
+	int ret;
+
+	if (new_state->crtc)
+		crtc_state = drm_atomic_get_new_crtc_state(state,
+							   new_state->crtc);
+
+	ret = drm_atomic_helper_check_plane_state(new_state, crtc_state,
+						  DRM_PLANE_NO_SCALING,
+						  DRM_PLANE_NO_SCALING, true,
+						  true);
+	if (ret || !new_state->visible)
+		return ret;
+
+	if (new_state->fb->width > TRIGGER5_CURSOR_SIZE ||
+	    new_state->fb->height > TRIGGER5_CURSOR_SIZE)
+		return -EINVAL;
+
+	return 0;
+}
+
+// Copy the visible part of the cursor so conversion never touches its GEM
+static int trigger5_cursor_load(struct trigger5_cursor_image *cursor,
+				struct drm_plane_state *state)
+{
+	struct drm_shadow_plane_state *shadow_plane_state =
+		to_drm_shadow_plane_state(state);
+	struct drm_framebuffer *fb = state->fb;
+	unsigned int width = drm_rect_width(&state->dst);
+	unsigned int height = drm_rect_height(&state->dst);
+	const u8 *vaddr = shadow_plane_state->data[0].vaddr;
+	unsigned int y;
+	int ret;
+
+	ret = drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE);
+	if (ret)
+		return ret;
+
+	vaddr += (state->src.y1 >> 16) * fb->pitches[0] +
+		 (state->src.x1 >> 16) * 4;
+	for (y = 0; y < height; y++) {
+		memcpy(&cursor->data[y * TRIGGER5_CURSOR_SIZE], vaddr,
+		       width * 4);
+		vaddr += fb->pitches[0];
+	}
+
+	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+	return 0;
+}
+
+static void trigger5_cursor_atomic_update(struct drm_plane *plane,
+					  struct drm_atomic_state *state)
+{
+	struct trigger5_device *trigger5 = to_trigger5(plane->dev);
+	struct trigger5_cursor_image *cursor = &trigger5->cursor.image;
+	struct drm_plane_state *new_state =
+		drm_atomic_get_new_plane_state(state, plane);
+	struct drm_plane_state *primary = trigger5->display_pipe.plane.state;
+	struct drm_rect rects[2], bounds;
+	unsigned int num_rects = 0, i;
+
+	// Uncover where the cursor was
+	if (cursor->visible)
+		rects[num_rects++] = cursor->rect;
+
+	// The next snapshot copies the new image, the worker never reads this
+	cursor->seq++;
+	cursor->visible = new_state->visible &&
+			  !trigger5_cursor_load(cursor, new_state);
+	if (cursor->visible) {
+		// CRTC coordinates, offset by the primary plane's source
+		cursor->rect = new_state->dst;
+		drm_rect_translate(&cursor->rect, primary->src.x1 >> 16,
+				   primary->src.y1 >> 16);
+		rects[num_rects++] = cursor->rect;
+	}
+
+	if (!primary->fb || !trigger5->display_pipe.crtc.state->active) {
+		trigger5_run_update(trigger5, NULL, NULL, 0, false);
+		return;
+	}
+
+	drm_rect_init(&bounds, 0, 0, primary->fb->width, primary->fb->height);
+	for (i = 0; i < num_rects;)
+		if (drm_rect_intersect(&rects[i], &bounds))
+			i++;
+		else
+			rects[i] = rects[--num_rects];
+	num_rects = trigger5_merge_rects(rects, num_rects,
+					 trigger5->wire_bpp / 8);
+
+	// The framebuffer did not change here, so there is nothing to diff
+	trigger5_run_update(trigger5, primary->fb, rects, num_rects, false);
+}
+
+static const struct drm_plane_helper_funcs trigger5_cursor_helper_funcs = {
+	DRM_GEM_SHADOW_PLANE_HELPER_FUNCS,
+	.atomic_check = trigger5_cursor_atomic_check,
+	.atomic_update = trigger5_cursor_atomic_update,
+};
+
+static const struct drm_plane_funcs trigger5_cursor_funcs = {
+	.update_plane = drm_atomic_helper_update_plane,
+	.disable_plane = drm_atomic_helper_disable_plane,
+	.destroy = drm_plane_cleanup,
+	DRM_GEM_SHADOW_PLANE_FUNCS,
+};
+
+int trigger5_cursor_init(struct trigger5_device *trigger5)
+{
+	struct drm_device *dev = &trigger5->drm;
+	struct drm_plane *plane = &trigger5->cursor.plane;
+	int ret;
+
+	ret = drm_universal_plane_init(dev, plane,
+				       drm_crtc_mask(&trigger5->display_pipe.crtc),
+				       &trigger5_cursor_funcs,
+				       trigger5_cursor_formats,
+				       ARRAY_SIZE(trigger5_cursor_formats),
+				       NULL, DRM_PLANE_TYPE_CURSOR, NULL);
+	if (ret)
+		return ret;
+
+	drm_plane_helper_add(plane, &trigger5_cursor_helper_funcs);
+	trigger5->display_pipe.crtc.cursor = plane;
+	dev->mode_config.cursor_width = TRIGGER5_CURSOR_SIZE;
+	dev->mode_config.cursor_height = TRIGGER5_CURSOR_SIZE;
+
+	return 0;
+}
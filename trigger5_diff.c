@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/bitmap.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+
+#include <asm/unaligned.h>
+
+#include <drm/drm_fourcc.h>
+#include <drm/drm_managed.h>
+
+#include "trigger5.h"
+
+static bool frame_diff;
+module_param(frame_diff, bool, 0644);
+MODULE_PARM_DESC(frame_diff, "Only send tiles that changed since the last frame (default false)");
+
+#define TRIGGER5_TILE_WIDTH	64
+#define TRIGGER5_TILE_HEIGHT	16
+
+static void trigger5_diff_free(struct trigger5_diff *diff)
+{
+	vfree(diff->shadow);
+	bitmap_free(diff->dirty);
+	diff->shadow = NULL;
+	diff->dirty = NULL;
+	diff->valid = false;
+}
+
+static int trigger5_diff_alloc(struct trigger5_diff *diff,
+			       const struct drm_framebuffer *fb)
+{
+	unsigned int tiles = DIV_ROUND_UP(fb->width, TRIGGER5_TILE_WIDTH) *
+			     DIV_ROUND_UP(fb->height, TRIGGER5_TILE_HEIGHT);
+
+	if (diff->shadow && diff->width == fb->width &&
+	    diff->height == fb->height && diff->format == fb->format->format)
+		return 0;
+	trigger5_diff_free(diff);
+
+	diff->pitch = fb->width * fb->format->cpp[0];
+	diff->shadow = vmalloc(array_size(diff->pitch, fb->height));
+	diff->dirty = bitmap_zalloc(tiles, GFP_KERNEL);
+	if (!diff->shadow || !diff->dirty) {
+		trigger5_diff_free(diff);
+		return -ENOMEM;
+	}
+	diff->width = fb->width;
+	diff->height = fb->height;
+	diff->format = fb->format->format;
+
+	return 0;
+}
+
+/*
+ * Compare a row a word at a time, folding the differences together so the
+ * loop has no data dependent branch until the end of the row. Rows of 24
+ * bpp framebuffers and odd pitches start at any byte, so load the words
+ * unaligned. With the vector unit claimed, the converter's kernel takes
+ * the row first and this only finishes the tail.
+ */
+static bool trigger5_diff_row(const struct trigger5_converter *converter,
+			      const u8 *a, const u8 *b, unsigned int len)
+{
+	const unsigned long *wa, *wb;
+	unsigned long acc = 0;
+	unsigned int i, words;
+
+	if (converter) {
+		i = converter->equal_bytes(a, b, len);
+		a += i;
+		b += i;
+		len -= i;
+	}
+	wa = (const unsigned long *)a;
+	wb = (const unsigned long *)b;
+	words = len / sizeof(unsigned long);
+
+	for (i = 0; i + 4 <= words; i += 4)
+		acc |= (get_unaligned(&wa[i]) ^ get_unaligned(&wb[i])) |
+		       (get_unaligned(&wa[i + 1]) ^ get_unaligned(&wb[i + 1])) |
+		       (get_unaligned(&wa[i + 2]) ^ get_unaligned(&wb[i + 2])) |
+		       (get_unaligned(&wa[i + 3]) ^ get_unaligned(&wb[i + 3]));
+	for (; i < words; i++)
+		acc |= get_unaligned(&wa[i]) ^ get_unaligned(&wb[i]);
+
+	if (acc)
+		return true;
+	i *= sizeof(unsigned long);
+	return memcmp(a + i, b + i, len - i) != 0;
+}
+
+/*
+ * Test one tile against the shadow copy and refresh the copy if it changed.
+ * The vector unit is claimed per tile, like per line for the conversion.
+ */
+static bool trigger5_diff_tile(const struct trigger5_converter *converter,
+			       struct trigger5_diff *diff, const u8 *src,
+			       unsigned int src_pitch, unsigned int cpp,
+			       const struct drm_rect *tile)
+{
+	unsigned int len = drm_rect_width(tile) * cpp;
+	const u8 *s = src + tile->y1 * src_pitch + tile->x1 * cpp;
+	u8 *d = diff->shadow + tile->y1 * diff->pitch + tile->x1 * cpp;
+	unsigned int y;
+
+	if (!converter->equal_bytes || !trigger5_simd_begin())
+		converter = NULL;
+	for (y = tile->y1; y < tile->y2; y++) {
+		if (trigger5_diff_row(converter, s, d, len))
+			break;
+		s += src_pitch;
+		d += diff->pitch;
+	}
+	if (converter)
+		trigger5_simd_end();
+	if (y == tile->y2)
+		return false;
+
+	// Rows above the first difference already match
+	for (; y < tile->y2; y++) {
+		memcpy(d, s, len);
+		s += src_pitch;
+		d += diff->pitch;
+	}
+	return true;
+}
+
+/*
+ * Shrink the damage rectangles to the tiles whose pixels differ from the
+ * last frame sent. Returns the new number of rectangles, which is zero when
+ * nothing changed, and covers the whole plane source after a resync.
+ */
+unsigned int trigger5_diff_rects(struct trigger5_device *trigger5,
+				 const struct drm_framebuffer *fb,
+				 const struct iosys_map *map,
+				 const struct drm_rect *src,
+				 struct drm_rect *rects, unsigned int num_rects)
+{
+	struct trigger5_diff *diff = &trigger5->diff;
+	unsigned int cpp = fb->format->cpp[0];
+	unsigned int tiles_x = DIV_ROUND_UP(fb->width, TRIGGER5_TILE_WIDTH);
+	unsigned int tiles_y = DIV_ROUND_UP(fb->height, TRIGGER5_TILE_HEIGHT);
+	unsigned int i, tx, ty, start, end, row, checked = 0, sent = 0;
+	const u8 *vaddr = map->vaddr;
+	struct drm_rect clip, tile;
+	unsigned long bit;
+
+	if (!frame_diff || map->is_iomem || fb->format->num_planes != 1 ||
+	    trigger5_diff_alloc(diff, fb)) {
+		diff->valid = false;
+		return num_rects;
+	}
+
+	if (!diff->valid) {
+		/*
+		 * Resynchronise the shadow copy. The device may be missing
+		 * more than this damage after a dropped frame, so send the
+		 * whole plane source to match it.
+		 */
+		for (i = 0; i < fb->height; i++)
+			memcpy(diff->shadow + i * diff->pitch,
+			       vaddr + i * fb->pitches[0], diff->pitch);
+		diff->valid = true;
+		drm_rect_fp_to_int(&rects[0], src);
+		return 1;
+	}
+
+	// Mark every tile touched by damage once, even where rects overlap
+	bitmap_zero(diff->dirty, tiles_x * tiles_y);
+	for (i = 0; i < num_rects; i++) {
+		for (ty = rects[i].y1 / TRIGGER5_TILE_HEIGHT;
+		     ty <= (rects[i].y2 - 1) / TRIGGER5_TILE_HEIGHT; ty++)
+			bitmap_set(diff->dirty,
+				   ty * tiles_x + rects[i].x1 / TRIGGER5_TILE_WIDTH,
+				   (rects[i].x2 - 1) / TRIGGER5_TILE_WIDTH -
+					   rects[i].x1 / TRIGGER5_TILE_WIDTH + 1);
+	}
+
+	// Keep only the tiles whose contents changed
+	for_each_set_bit(bit, diff->dirty, tiles_x * tiles_y) {
+		tx = bit % tiles_x;
+		ty = bit / tiles_x;
+		drm_rect_init(&tile, tx * TRIGGER5_TILE_WIDTH,
+			      ty * TRIGGER5_TILE_HEIGHT, TRIGGER5_TILE_WIDTH,
+			      TRIGGER5_TILE_HEIGHT);
+		tile.x2 = min_t(int, tile.x2, fb->width);
+		tile.y2 = min_t(int, tile.y2, fb->height);
+
+		checked++;
+		if (trigger5_diff_tile(trigger5->converter, diff, vaddr,
+				       fb->pitches[0], cpp, &tile))
+			sent++;
+		else
+			__clear_bit(bit, diff->dirty);
+	}
+
+	atomic64_add(checked, &trigger5->stats.tiles_checked);
+	atomic64_add(sent, &trigger5->stats.tiles_sent);
+
+	// Turn runs of changed tiles into rectangles within the plane source
+	drm_rect_fp_to_int(&clip, src);
+	num_rects = 0;
+	for (ty = 0; ty < tiles_y && sent; ty++) {
+		row = ty * tiles_x;
+		start = find_next_bit(diff->dirty, row + tiles_x, row);
+		while (start < row + tiles_x) {
+			end = find_next_zero_bit(diff->dirty, row + tiles_x,
+						 start);
+			tile.x1 = (start - row) * TRIGGER5_TILE_WIDTH;
+			tile.x2 = (end - row) * TRIGGER5_TILE_WIDTH;
+			tile.y1 = ty * TRIGGER5_TILE_HEIGHT;
+			tile.y2 = tile.y1 + TRIGGER5_TILE_HEIGHT;
+			if (drm_rect_intersect(&tile, &clip)) {
+				// Grow the run above when the columns line up
+				for (i = 0; i < num_rects; i++) {
+					if (rects[i].x1 == tile.x1 &&
+					    rects[i].x2 == tile.x2 &&
+					    rects[i].y2 == tile.y1) {
+						rects[i].y2 = tile.y2;
+						break;
+					}
+				}
+				if (i == num_rects)
+					trigger5_add_rect(rects, &num_rects,
+							  &tile);
+			}
+			start = find_next_bit(diff->dirty, row + tiles_x, end);
+		}
+	}
+
+	return trigger5_merge_rects(rects, num_rects, trigger5->wire_bpp / 8);
+}
+
+void trigger5_diff_invalidate(struct trigger5_device *trigger5)
+{
+	trigger5->diff.valid = false;
+}
+
+static void trigger5_diff_release(struct drm_device *dev, void *res)
+{
+	trigger5_diff_free(&to_trigger5(dev)->diff);
+}
+
+int trigger5_diff_init(struct trigger5_device *trigger5)
+{
+	return drmm_add_action_or_reset(&trigger5->drm, trigger5_diff_release,
+					NULL);
+}
@@ -1,10 +1,17 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
 #include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/timekeeping.h>
 
 #include <drm/drm_atomic_helper.h>
 #include <drm/drm_crtc_helper.h>
 #include <drm/drm_damage_helper.h>
+#include <drm/drm_debugfs.h>
 #include <drm/drm_drv.h>
 #include <drm/drm_fb_helper.h>
 #include <drm/drm_fbdev_generic.h>
@@ -18,22 +25,27 @@
 #include <drm/drm_probe_helper.h>
 #include <drm/drm_print.h>
 #include <drm/drm_simple_kms_helper.h>
+#include <drm/drm_vblank.h>
 
 #include "trigger5.h"
+#include "trigger5_trace.h"
 
 static int trigger5_usb_suspend(struct usb_interface *interface,
 				pm_message_t message)
 {
-	struct drm_device *dev = usb_get_intfdata(interface);
+	struct trigger5_device *trigger5 = usb_get_intfdata(interface);
 
-	return drm_mode_config_helper_suspend(dev);
+	flush_work(&trigger5->init_work);
+	trigger5_hpd_stop(trigger5);
+	return drm_mode_config_helper_suspend(&trigger5->drm);
 }
 
 static int trigger5_usb_resume(struct usb_interface *interface)
 {
-	struct drm_device *dev = usb_get_intfdata(interface);
+	struct trigger5_device *trigger5 = usb_get_intfdata(interface);
 
-	return drm_mode_config_helper_resume(dev);
+	trigger5_hpd_start(trigger5);
+	return drm_mode_config_helper_resume(&trigger5->drm);
 }
 
 /*
@@ -53,6 +65,152 @@ trigger5_driver_gem_prime_import(struct drm_device *dev,
 	return drm_gem_prime_import_dev(dev, dma_buf, trigger5->dmadev);
 }
 
+static int trigger5_debugfs_stats_show(struct seq_file *m, void *unused)
+{
+	struct drm_info_node *node = m->private;
+	struct trigger5_device *trigger5 = to_trigger5(node->minor->dev);
+	struct trigger5_stats *stats = &trigger5->stats;
+
+	seq_printf(m, "frames_queued: %lld\n",
+		   atomic64_read(&stats->frames_queued));
+	seq_printf(m, "frames_transferred: %lld\n",
+		   atomic64_read(&stats->frames_transferred));
+	seq_printf(m, "frames_overlapped: %lld\n",
+		   atomic64_read(&stats->frames_overlapped));
+	seq_printf(m, "ring_waits: %lld\n", atomic64_read(&stats->ring_waits));
+	seq_printf(m, "frames_coalesced: %lld\n",
+		   atomic64_read(&stats->frames_coalesced));
+	seq_printf(m, "frames_dropped: %lld\n",
+		   atomic64_read(&stats->frames_dropped));
+	seq_printf(m, "rects_sent: %lld\n", atomic64_read(&stats->rects_sent));
+	seq_printf(m, "tiles_checked: %lld\n",
+		   atomic64_read(&stats->tiles_checked));
+	seq_printf(m, "tiles_sent: %lld\n", atomic64_read(&stats->tiles_sent));
+	seq_printf(m, "pll_cache_hits: %lld\n",
+		   atomic64_read(&stats->pll_cache_hits));
+	seq_printf(m, "pll_cache_misses: %lld\n",
+		   atomic64_read(&stats->pll_cache_misses));
+	seq_printf(m, "edid_cache_hits: %lld\n",
+		   atomic64_read(&stats->edid_cache_hits));
+	seq_printf(m, "edid_cache_misses: %lld\n",
+		   atomic64_read(&stats->edid_cache_misses));
+	seq_printf(m, "hpd_irqs: %lld\n", atomic64_read(&stats->hpd_irqs));
+	seq_printf(m, "frames_zero_copy: %lld\n",
+		   atomic64_read(&stats->frames_zero_copy));
+	seq_printf(m, "buffer_allocs: %lld\n",
+		   atomic64_read(&stats->buffer_allocs));
+	seq_printf(m, "buffer_allocs_avoided: %lld\n",
+		   atomic64_read(&stats->buffer_allocs_avoided));
+	seq_printf(m, "bytes_sent: %lld\n", atomic64_read(&stats->bytes_sent));
+	seq_printf(m, "urb_errors: %lld\n", atomic64_read(&stats->urb_errors));
+	seq_printf(m, "urb_timeouts: %lld\n",
+		   atomic64_read(&stats->urb_timeouts));
+	seq_printf(m, "frames_timed_out: %lld\n",
+		   atomic64_read(&stats->frames_timed_out));
+	seq_printf(m, "ring_wait_us: %lld\n",
+		   div_u64(atomic64_read(&stats->ring_wait_ns), NSEC_PER_USEC));
+	seq_printf(m, "urbs: %u x %u bytes\n", trigger5->num_urbs,
+		   trigger5->urb_size);
+	seq_printf(m, "probe_us: %llu\n",
+		   div_u64(trigger5->boot.probed, NSEC_PER_USEC));
+	seq_printf(m, "init_us: %llu\n",
+		   div_u64(trigger5->boot.initialised, NSEC_PER_USEC));
+	seq_printf(m, "first_frame_us: %llu\n",
+		   div_u64(READ_ONCE(trigger5->boot.first_frame),
+			   NSEC_PER_USEC));
+	seq_printf(m, "conversion: %s\n", trigger5->converter->name);
+	seq_printf(m, "wire_bpp: %u\n", trigger5->wire_bpp);
+	return 0;
+}
+
+static void trigger5_debugfs_show_hist(struct seq_file *m, const char *name,
+				       struct trigger5_histogram *hist)
+{
+	unsigned int i;
+
+	seq_printf(m, "%s:\n", name);
+	for (i = 0; i < TRIGGER5_HIST_BUCKETS - 1; i++)
+		seq_printf(m, "  <%6u us: %lld\n", 1 << i,
+			   atomic64_read(&hist->buckets[i]));
+	seq_printf(m, "  >=%5u us: %lld\n", 1 << (i - 1),
+		   atomic64_read(&hist->buckets[i]));
+}
+
+static int trigger5_debugfs_perf_show(struct seq_file *m, void *unused)
+{
+	struct drm_info_node *node = m->private;
+	struct trigger5_device *trigger5 = to_trigger5(node->minor->dev);
+	struct trigger5_stats *stats = &trigger5->stats;
+	u64 now = ktime_get_ns(), fps = 0, bps = 0;
+	struct trigger5_rate rate;
+	unsigned long flags;
+
+	spin_lock_irqsave(&trigger5->queue_lock, flags);
+	rate = trigger5->rate;
+	spin_unlock_irqrestore(&trigger5->queue_lock, flags);
+
+	// Report nothing once the display has been idle for a full window
+	if (rate.window && now - rate.start < 2 * NSEC_PER_SEC) {
+		fps = div64_u64((u64)rate.last_frames * 1000 * NSEC_PER_SEC,
+				rate.window);
+		bps = div64_u64(rate.last_bytes * NSEC_PER_SEC, rate.window);
+	}
+
+	seq_printf(m, "fps: %llu.%03llu\n", div_u64(fps, 1000),
+		   fps % 1000);
+	seq_printf(m, "MB/s: %llu.%03llu\n", div_u64(bps, 1000000),
+		   div_u64(bps % 1000000, 1000));
+	trigger5_debugfs_show_hist(m, "convert_time", &stats->convert_time);
+	trigger5_debugfs_show_hist(m, "transfer_time", &stats->transfer_time);
+	trigger5_debugfs_show_hist(m, "latency", &stats->latency);
+	return 0;
+}
+
+static const struct drm_info_list trigger5_debugfs_list[] = {
+	{ "stats", trigger5_debugfs_stats_show, 0 },
+	{ "perf", trigger5_debugfs_perf_show, 0 },
+	{ "convert_bench", trigger5_convert_bench_show, 0 },
+	{ "bench", trigger5_bench_show, 0 },
+};
+
+static ssize_t trigger5_debugfs_reset_write(struct file *file,
+					    const char __user *buf,
+					    size_t count, loff_t *ppos)
+{
+	struct trigger5_device *trigger5 = file->private_data;
+	atomic64_t *counters = (atomic64_t *)&trigger5->stats;
+	unsigned long flags;
+	unsigned int i;
+
+	// The stats are nothing but counters, so clear them as an array
+	for (i = 0; i < sizeof(trigger5->stats) / sizeof(*counters); i++)
+		atomic64_set(&counters[i], 0);
+
+	spin_lock_irqsave(&trigger5->queue_lock, flags);
+	memset(&trigger5->rate, 0, sizeof(trigger5->rate));
+	trigger5->rate.start = ktime_get_ns();
+	spin_unlock_irqrestore(&trigger5->queue_lock, flags);
+
+	return count;
+}
+
+static const struct file_operations trigger5_debugfs_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = trigger5_debugfs_reset_write,
+	.llseek = noop_llseek,
+};
+
+static void trigger5_debugfs_init(struct drm_minor *minor)
+{
+	drm_debugfs_create_files(trigger5_debugfs_list,
+				 ARRAY_SIZE(trigger5_debugfs_list),
+				 minor->debugfs_root, minor);
+	debugfs_create_file("reset_stats", 0200, minor->debugfs_root,
+			    to_trigger5(minor->dev),
+			    &trigger5_debugfs_reset_fops);
+}
+
 DEFINE_DRM_GEM_FOPS(trigger5_driver_fops);
 
 static const struct drm_driver driver = {
@@ -62,6 +220,7 @@ static const struct drm_driver driver = {
 	.fops = &trigger5_driver_fops,
 	DRM_GEM_SHMEM_DRIVER_OPS,
 	.gem_prime_import = trigger5_driver_gem_prime_import,
+	.debugfs_init = trigger5_debugfs_init,
 
 	.name = DRIVER_NAME,
 	.desc = DRIVER_DESC,
@@ -77,64 +236,115 @@ static const struct drm_mode_config_funcs trigger5_mode_config_funcs = {
 	.atomic_commit = drm_atomic_helper_commit,
 };
 
-static const int trigger5_get_mode(struct trigger5_device *trigger5,
-				   const struct drm_display_mode *mode)
-{
-	unsigned int num_modes =
-		min((u16)52, be16_to_cpu(trigger5->mode_list.count));
-	unsigned int i;
+static unsigned int output_bpp = 24;
+module_param(output_bpp, uint, 0644);
+MODULE_PARM_DESC(output_bpp, "Wire format bits per pixel, 16 or 24 (default 24), applied on the next update");
 
-	for (i = 0; i < num_modes; i++) {
-		const struct trigger5_mode *trigger5_mode =
-			&trigger5->mode_list.modes[i];
+/*
+ * Program a mode at the requested wire depth, falling back to 24 bpp when
+ * the device has no 16 bpp variant of it.
+ */
+static void trigger5_program_mode(struct trigger5_device *trigger5,
+				  const struct drm_display_mode *mode,
+				  unsigned int bpp)
+{
+	struct trigger6_mode_request *request;
+	int mode_number;
+	u8 *data;
 
-		if (le16_to_cpu(trigger5_mode->width) == mode->hdisplay &&
-		    le16_to_cpu(trigger5_mode->height) == mode->vdisplay &&
-		    trigger5_mode->hz == drm_mode_vrefresh(mode))
-			return trigger5_mode->mode_number;
+	trace_trigger5_modeset(trigger5->frame_counter & 0xfff,
+			       TRIGGER5_MODESET_BEGIN, -1, mode->clock);
+
+	// Sequence cloned from captures
+	data = kmalloc(4, GFP_KERNEL);
+	usb_control_msg(
+		interface_to_usbdev(trigger5->intf),
+		usb_rcvctrlpipe(interface_to_usbdev(trigger5->intf), 0),
+		0xd1, USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
+		0x0000, 0x0000, data, 1, USB_CTRL_GET_TIMEOUT);
+
+	request = kmalloc(sizeof(struct trigger6_mode_request), GFP_KERNEL);
+	trigger5->wire_bpp = bpp;
+	trigger5->missing_bpp = 0;
+	mode_number = trigger5_find_mode(&trigger5->mode_list, mode, bpp);
+	if (mode_number < 0) {
+		drm_dbg(&trigger5->drm,
+			"no 16 bpp variant of mode, using 24 bpp\n");
+		trigger5->wire_bpp = 24;
+		trigger5->missing_bpp = bpp;
+		mode_number = trigger5_find_mode(&trigger5->mode_list, mode, 24);
 	}
 
-	// Any mode is supported by setting the right parameters
-	// Return the last mode number
-	return trigger5->mode_list.modes[num_modes - 1].mode_number;
-}
-
-static u64 trigger5_calculate_pll(struct trigger5_pll *pll, int clock)
-{
-	u64 ref_clock = 10000000;
-	u64 target_clock = clock * 1000;
-	u64 calculated_clock, calculated_err, best_err = U64_MAX;
-	int prediv, mul1, mul2, div1, div2;
-
-	// Use values found in the capture
-	for (prediv = 1; prediv <= 0x10; prediv <<= 1) {
-		for (mul1 = 1; mul1 <= 0x32; mul1++) {
-			for (mul2 = 1; mul2 <= 0x32; mul2++) {
-				for (div1 = 1; div1 <= 0x32; div1++) {
-					for (div2 = 0x02; div2 <= 0x10;
-					     div2 <<= 1) {
-						calculated_clock = ref_clock *
-								   mul1 * mul2 /
-								   prediv /
-								   div1 / div2;
-						calculated_err =
-							abs(calculated_clock -
-							    target_clock);
-						if (calculated_err < best_err) {
-							best_err =
-								calculated_err;
-							pll->mul1 = mul1;
-							pll->mul2 = mul2;
-							pll->div1 = div1;
-							pll->div2 = div2;
-							pll->unknown = prediv;
-						}
-					}
-				}
-			}
-		}
-	}
-	return best_err;
+	trigger5_fill_mode_request(request, mode);
+
+	trigger5_get_pll(trigger5, &request->pll, mode->clock);
+	trace_trigger5_modeset(trigger5->frame_counter & 0xfff,
+			       TRIGGER5_MODESET_PLL, mode_number,
+			       mode->clock);
+	long long int clk = 10000000LL * request->pll.mul1 *
+			    request->pll.mul2 / request->pll.unknown /
+			    request->pll.div1 / request->pll.div2 /
+			    1000;
+	drm_info(&trigger5->drm,
+		 "pll: %02x %02x %02x %02x %02x %d %d\n",
+		 request->pll.unknown, request->pll.mul1,
+		 request->pll.mul2, request->pll.div1,
+		 request->pll.div2, (int)clk, mode->clock);
+
+	usb_control_msg(
+		interface_to_usbdev(trigger5->intf),
+		usb_sndctrlpipe(interface_to_usbdev(trigger5->intf), 0),
+		TRIGGER5_REQUEST_SET_MODE,
+		USB_DIR_OUT | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
+		mode_number, 0, request,
+		sizeof(struct trigger6_mode_request),
+		USB_CTRL_SET_TIMEOUT);
+	trace_trigger5_modeset(trigger5->frame_counter & 0xfff,
+			       TRIGGER5_MODESET_SET_MODE, mode_number,
+			       mode->clock);
+
+	kfree(request);
+
+	usb_control_msg(
+		interface_to_usbdev(trigger5->intf),
+		usb_rcvctrlpipe(interface_to_usbdev(trigger5->intf), 0),
+		0xd1, USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
+		0x0201, 0x0000, data, 1, USB_CTRL_GET_TIMEOUT);
+
+	usb_control_msg(
+		interface_to_usbdev(trigger5->intf),
+		usb_rcvctrlpipe(interface_to_usbdev(trigger5->intf), 0),
+		0xa5, USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
+		0x0000, 0xec34, data, 4, USB_CTRL_GET_TIMEOUT);
+
+	data[0] = 0x60;
+	data[1] = 0x00;
+	data[2] = 0x00;
+	data[3] = 0x10;
+	usb_control_msg(
+		interface_to_usbdev(trigger5->intf),
+		usb_sndctrlpipe(interface_to_usbdev(trigger5->intf), 0),
+		0xc4, USB_DIR_OUT | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
+		0x0000, 0xec34, data, 4, USB_CTRL_SET_TIMEOUT);
+
+	usb_control_msg(
+		interface_to_usbdev(trigger5->intf),
+		usb_sndctrlpipe(interface_to_usbdev(trigger5->intf), 0),
+		0xc8, USB_DIR_OUT | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
+		0x0000, 0xec34, data, 4, USB_CTRL_SET_TIMEOUT);
+
+	kfree(data);
+	trace_trigger5_modeset(trigger5->frame_counter & 0xfff,
+			       TRIGGER5_MODESET_DONE, mode_number,
+			       mode->clock);
+}
+
+// Depth asked for by the output_bpp parameter and the quality controller
+static unsigned int trigger5_wanted_bpp(struct trigger5_device *trigger5)
+{
+	if (output_bpp == 16 || READ_ONCE(trigger5->quality.reduced))
+		return 16;
+	return 24;
 }
 
 static void trigger5_pipe_enable(struct drm_simple_display_pipe *pipe,
@@ -142,120 +352,97 @@ static void trigger5_pipe_enable(struct drm_simple_display_pipe *pipe,
 				 struct drm_plane_state *plane_state)
 {
 	struct trigger5_device *trigger5 = to_trigger5(pipe->crtc.dev);
-	struct drm_display_mode *mode = &crtc_state->mode;
-	struct trigger6_mode_request *request;
-	u8 mode_number;
-	u8 *data;
 
-	if (crtc_state->mode_changed) {
-		// Sequence cloned from captures
-		data = kmalloc(4, GFP_KERNEL);
-		usb_control_msg(
-			interface_to_usbdev(trigger5->intf),
-			usb_rcvctrlpipe(interface_to_usbdev(trigger5->intf), 0),
-			0xd1, USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
-			0x0000, 0x0000, data, 1, USB_CTRL_GET_TIMEOUT);
-
-		request = kmalloc(sizeof(struct trigger6_mode_request),
-				  GFP_KERNEL);
-		mode_number = trigger5_get_mode(trigger5, mode);
-
-		request->height = cpu_to_be16(mode->vdisplay);
-		request->height_minus_one = cpu_to_be16(mode->vdisplay - 1);
-		request->width = cpu_to_be16(mode->hdisplay);
-		request->width_minus_one = cpu_to_be16(mode->hdisplay - 1);
-
-		request->line_total_pixels = cpu_to_be16(mode->htotal - 1);
-		request->line_sync_pulse =
-			cpu_to_be16(mode->hsync_end - mode->hsync_start - 1);
-		request->line_back_porch =
-			cpu_to_be16(mode->htotal - mode->hsync_end - 1);
-
-		request->frame_total_lines = cpu_to_be16(mode->vtotal - 1);
-		request->frame_sync_pulse =
-			cpu_to_be16(mode->vsync_end - mode->vsync_start - 1);
-		request->frame_back_porch =
-			cpu_to_be16(mode->vtotal - mode->vsync_end - 1);
-		request->unknown1 = 0xff;
-		request->unknown2 = 0xff;
-		request->unknown3 = 0xff;
-		request->unknown4 = 0xff;
-
-		request->hsync_polarity =
-			(mode->flags & DRM_MODE_FLAG_PHSYNC) ? 0 : 1;
-		request->vsync_polarity =
-			(mode->flags & DRM_MODE_FLAG_PVSYNC) ? 0 : 1;
-
-		trigger5_calculate_pll(&request->pll, mode->clock);
-		long long int clk = 10000000LL * request->pll.mul1 *
-				    request->pll.mul2 / request->pll.unknown /
-				    request->pll.div1 / request->pll.div2 /
-				    1000;
-		drm_info(&trigger5->drm,
-			 "pll: %02x %02x %02x %02x %02x %d %d\n",
-			 request->pll.unknown, request->pll.mul1,
-			 request->pll.mul2, request->pll.div1,
-			 request->pll.div2, (int)clk, mode->clock);
-
-		usb_control_msg(
-			interface_to_usbdev(trigger5->intf),
-			usb_sndctrlpipe(interface_to_usbdev(trigger5->intf), 0),
-			TRIGGER5_REQUEST_SET_MODE,
-			USB_DIR_OUT | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
-			mode_number, 0, request,
-			sizeof(struct trigger6_mode_request),
-			USB_CTRL_SET_TIMEOUT);
-
-		kfree(request);
-
-		usb_control_msg(
-			interface_to_usbdev(trigger5->intf),
-			usb_rcvctrlpipe(interface_to_usbdev(trigger5->intf), 0),
-			0xd1, USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
-			0x0201, 0x0000, data, 1, USB_CTRL_GET_TIMEOUT);
-
-		usb_control_msg(
-			interface_to_usbdev(trigger5->intf),
-			usb_rcvctrlpipe(interface_to_usbdev(trigger5->intf), 0),
-			0xa5, USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
-			0x0000, 0xec34, data, 4, USB_CTRL_GET_TIMEOUT);
-
-		data[0] = 0x60;
-		data[1] = 0x00;
-		data[2] = 0x00;
-		data[3] = 0x10;
-		usb_control_msg(
-			interface_to_usbdev(trigger5->intf),
-			usb_sndctrlpipe(interface_to_usbdev(trigger5->intf), 0),
-			0xc4, USB_DIR_OUT | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
-			0x0000, 0xec34, data, 4, USB_CTRL_SET_TIMEOUT);
-
-		usb_control_msg(
-			interface_to_usbdev(trigger5->intf),
-			usb_sndctrlpipe(interface_to_usbdev(trigger5->intf), 0),
-			0xc8, USB_DIR_OUT | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
-			0x0000, 0xec34, data, 4, USB_CTRL_SET_TIMEOUT);
-
-		kfree(data);
-	}
+	// Modesets wait for the worker and any depth switch, updates don't
+	cancel_work_sync(&trigger5->depth_work);
+	kthread_flush_work(&trigger5->update.work);
+	trigger5_diff_invalidate(trigger5);
+	trigger5->depth_backoff_ms = 0;
+	trigger5->depth_retry = jiffies;
+
+	if (crtc_state->mode_changed)
+		trigger5_program_mode(trigger5, &crtc_state->mode,
+				      trigger5_wanted_bpp(trigger5));
+	drm_mode_copy(&trigger5->mode, &crtc_state->mode);
+	WRITE_ONCE(trigger5->enabled, true);
+
+	drm_crtc_vblank_on(&pipe->crtc);
 }
 
 static void trigger5_pipe_disable(struct drm_simple_display_pipe *pipe)
 {
-	//struct trigger5_device *trigger5 = to_trigger5(pipe->crtc.dev);
+	struct trigger5_device *trigger5 = to_trigger5(pipe->crtc.dev);
+
+	WRITE_ONCE(trigger5->enabled, false);
+	cancel_work_sync(&trigger5->depth_work);
+	kthread_flush_work(&trigger5->update.work);
+
+	// Nothing to resend until the next enable
+	if (trigger5->update.last_fb) {
+		drm_framebuffer_put(trigger5->update.last_fb);
+		trigger5->update.last_fb = NULL;
+	}
+	drm_crtc_vblank_off(&pipe->crtc);
+}
+
+/*
+ * The device reports no vblank, so emulate one at the refresh rate of the
+ * programmed mode. Flips themselves complete when their frame is on the
+ * wire, this only gives compositors a clock to pace against.
+ */
+static enum hrtimer_restart trigger5_vblank_timer(struct hrtimer *timer)
+{
+	struct trigger5_device *trigger5 =
+		container_of(timer, struct trigger5_device, vblank_timer);
+
+	if (!READ_ONCE(trigger5->vblank_enabled))
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, READ_ONCE(trigger5->vblank_period));
+	drm_crtc_handle_vblank(&trigger5->display_pipe.crtc);
+	return HRTIMER_RESTART;
+}
+
+static int trigger5_pipe_enable_vblank(struct drm_simple_display_pipe *pipe)
+{
+	struct trigger5_device *trigger5 = to_trigger5(pipe->crtc.dev);
+	struct drm_vblank_crtc *vblank =
+		&pipe->crtc.dev->vblank[drm_crtc_index(&pipe->crtc)];
+
+	trigger5->vblank_framedur_ns = vblank->framedur_ns;
+	trigger5->vblank_period =
+		trigger5_quality_vblank_period(trigger5, vblank->framedur_ns);
+	WRITE_ONCE(trigger5->vblank_enabled, true);
+	hrtimer_start(&trigger5->vblank_timer, trigger5->vblank_period,
+		      HRTIMER_MODE_REL);
+	return 0;
+}
+
+static void trigger5_pipe_disable_vblank(struct drm_simple_display_pipe *pipe)
+{
+	struct trigger5_device *trigger5 = to_trigger5(pipe->crtc.dev);
+
+	// Called under the vblank locks the timer takes, so don't wait for it
+	WRITE_ONCE(trigger5->vblank_enabled, false);
+	hrtimer_try_to_cancel(&trigger5->vblank_timer);
+}
+
+static void trigger5_vblank_release(struct drm_device *dev, void *res)
+{
+	struct trigger5_device *trigger5 = to_trigger5(dev);
+
+	hrtimer_cancel(&trigger5->vblank_timer);
 }
 
 enum drm_mode_status
 trigger5_pipe_mode_valid(struct drm_simple_display_pipe *pipe,
 			 const struct drm_display_mode *mode)
 {
+	struct trigger5_device *trigger5 = to_trigger5(pipe->crtc.dev);
 	struct trigger5_pll pll;
-	u64 err = trigger5_calculate_pll(&pll, mode->clock);
-	u64 ppm = err * 1000000 / mode->clock;
-	if (ppm > 10000) {
-		return MODE_CLOCK_RANGE;
-	}
-	return MODE_OK;
+	u64 err = trigger5_get_pll(trigger5, &pll, mode->clock);
+
+	return trigger5_pll_mode_status(err, mode->clock);
 }
 
 int trigger5_pipe_check(struct drm_simple_display_pipe *pipe,
@@ -265,164 +452,567 @@ int trigger5_pipe_check(struct drm_simple_display_pipe *pipe,
 	return 0;
 }
 
-static u8 trigger5_bulk_header_checksum(struct trigger5_bulk_header *header)
+// Bytes needed on the wire to send a rectangle as its own segment
+static unsigned int trigger5_rect_cost(const struct drm_rect *rect,
+				       unsigned int cpp)
 {
-	u16 checksum = 0;
-	u8 *data = (u8 *)header;
-	int i;
+	return sizeof(struct trigger5_bulk_header) +
+	       drm_rect_width(rect) * drm_rect_height(rect) * cpp;
+}
 
-	for (i = 0; i < sizeof(struct trigger5_bulk_header) - 1; i++) {
-		checksum += data[i];
-	}
-	checksum &= 0xff;
-	checksum = 0x100 - checksum;
-	return checksum & 0xff;
+static void trigger5_rect_union(struct drm_rect *dst, const struct drm_rect *a,
+				const struct drm_rect *b)
+{
+	dst->x1 = min(a->x1, b->x1);
+	dst->y1 = min(a->y1, b->y1);
+	dst->x2 = max(a->x2, b->x2);
+	dst->y2 = max(a->y2, b->y2);
 }
 
-static void trigger5_bulk_timeout(struct timer_list *t)
+/*
+ * Merge pairs of rectangles only when their bounding box is cheaper to send
+ * than the two segments on their own.
+ */
+unsigned int trigger5_merge_rects(struct drm_rect *rects, unsigned int count,
+				  unsigned int cpp)
 {
-	struct trigger5_device *trigger5 = from_timer(trigger5, t, timer);
+	struct drm_rect merged;
+	unsigned int i, j;
+	bool changed;
+
+	do {
+		changed = false;
+		for (i = 0; i < count; i++) {
+			for (j = i + 1; j < count; j++) {
+				trigger5_rect_union(&merged, &rects[i],
+						    &rects[j]);
+				if (trigger5_rect_cost(&merged, cpp) >
+				    trigger5_rect_cost(&rects[i], cpp) +
+					    trigger5_rect_cost(&rects[j], cpp))
+					continue;
+				rects[i] = merged;
+				rects[j] = rects[--count];
+				changed = true;
+				// Rescan against the grown rectangle
+				j = i;
+			}
+		}
+	} while (changed);
 
-	usb_sg_cancel(&trigger5->sgr);
+	return count;
 }
 
-static void trigger5_free_bulk_buffer(struct trigger5_device *trigger5)
+void trigger5_add_rect(struct drm_rect *rects, unsigned int *count,
+		       const struct drm_rect *rect)
 {
-	if (!trigger5->frame_data)
+	if (*count == TRIGGER5_MAX_DAMAGE_RECTS) {
+		// Out of segments, fold the rest into the last one
+		trigger5_rect_union(&rects[*count - 1], &rects[*count - 1],
+				    rect);
 		return;
-	sg_free_table(&trigger5->transfer_sgt);
-	vfree(trigger5->frame_data);
-	trigger5->frame_data = NULL;
-	trigger5->frame_len = -1;
+	}
+	rects[(*count)++] = *rect;
 }
-static int trigger5_alloc_bulk_buffer(struct trigger5_device *trigger5,
-				      unsigned int len)
+
+static unsigned int trigger5_damage_rects(struct drm_plane_state *old_state,
+					  struct drm_plane_state *state,
+					  struct drm_rect *rects,
+					  unsigned int cpp)
 {
-	unsigned int num_pages;
-	int ret, i;
-	struct page **pages;
-	u8 *data;
-	void *ptr;
+	struct drm_atomic_helper_damage_iter iter;
+	struct drm_rect clip;
+	unsigned int count = 0;
 
-	if (trigger5->frame_len == len) {
-		return 0;
+	drm_atomic_helper_damage_iter_init(&iter, old_state, state);
+	drm_atomic_for_each_plane_damage(&iter, &clip) {
+		trigger5_add_rect(rects, &count, &clip);
 	}
-	trigger5_free_bulk_buffer(trigger5);
 
-	// Allocate buffer for bulk transfer
-	// Buffer may be very large so use vmalloc and scatterlist
-	data = vmalloc_32(len);
-	if (!data) {
-		return -ENOMEM;
+	return trigger5_merge_rects(rects, count, cpp);
+}
+
+/*
+ * An RGB888 or RGB565 framebuffer already holds the 24 or 16 bpp wire
+ * format. When the update is made of whole, unpadded rows it can be sent
+ * from the GEM pages.
+ */
+static bool trigger5_can_zero_copy(struct trigger5_device *trigger5,
+				   const struct trigger5_snapshot *snap,
+				   const struct drm_rect *rects,
+				   unsigned int num_rects)
+{
+	struct drm_framebuffer *fb = snap->fb;
+	struct drm_gem_object *obj = drm_gem_fb_get_obj(fb, 0);
+	u32 wire_format = trigger5->wire_bpp == 16 ? DRM_FORMAT_RGB565 :
+						     DRM_FORMAT_RGB888;
+
+	// The cursor is composed into a copy, never into the GEM pages
+	return trigger5->zero_copy && !snap->cursor.visible &&
+	       fb->format->format == wire_format && num_rects == 1 &&
+	       rects[0].x1 == 0 && rects[0].x2 == fb->width &&
+	       fb->pitches[0] == fb->width * fb->format->cpp[0] && obj &&
+	       !obj->import_attach;
+}
+
+/*
+ * Wait for every queued frame to leave the ring. A device that stopped
+ * taking data gets its URBs cancelled, which writes the frames off.
+ */
+static bool trigger5_drain_frames(struct trigger5_device *trigger5)
+{
+	unsigned long timeout = msecs_to_jiffies(1000);
+	struct completion *done;
+	unsigned int i;
+
+	for (i = 0; i < TRIGGER5_NUM_FRAMES; i++) {
+		done = &trigger5->frames[i].complete;
+		if (!wait_for_completion_timeout(done, timeout)) {
+			usb_kill_anchored_urbs(&trigger5->anchor);
+			if (!wait_for_completion_timeout(done, timeout))
+				return false;
+		}
+		complete(done);
 	}
 
-	num_pages = DIV_ROUND_UP(len, PAGE_SIZE);
-	pages = kmalloc_array(num_pages, sizeof(struct page *), GFP_KERNEL);
-	if (!pages) {
-		ret = -ENOMEM;
-		goto err_vfree;
+	return true;
+}
+
+/*
+ * Convert and queue one snapshot. The flip event is handed to the frame
+ * that carries it, and left in the snapshot when nothing was queued.
+ */
+static void trigger5_send_update(struct trigger5_device *trigger5,
+				 struct trigger5_snapshot *snap,
+				 const struct iosys_map *map)
+{
+	struct drm_framebuffer *fb = snap->fb;
+	struct drm_rect *rects = snap->damage;
+	struct drm_rect carried[TRIGGER5_MAX_DAMAGE_RECTS];
+	struct trigger5_bulk_header *header;
+	struct trigger5_frame *frame;
+	unsigned int num_rects, num_carried = 0, len, offset, i, cpp;
+	unsigned int block, pitch, rows, bpp;
+	struct iosys_map data_map;
+	struct drm_rect clip;
+	bool diff = true;
+	int y;
+	u64 start;
+	int ret;
+
+	// Switching depth drains the ring, so leave it to depth_work
+	bpp = trigger5_wanted_bpp(trigger5);
+	if (READ_ONCE(trigger5->enabled) && bpp != trigger5->wire_bpp &&
+	    bpp != trigger5->missing_bpp &&
+	    time_after_eq(jiffies, trigger5->depth_retry))
+		queue_work(system_long_wq, &trigger5->depth_work);
+
+	if (trigger5->update.resend) {
+		trigger5->update.resend = false;
+		drm_rect_init(&rects[0], 0, 0, fb->width, fb->height);
+		num_rects = 1;
+		snap->num_forced = 0;
+		diff = false;
+	} else {
+		num_rects = snap->num_damage;
+		if (!num_rects && !snap->num_forced)
+			return;
 	}
-	for (i = 0, ptr = data; i < num_pages; i++, ptr += PAGE_SIZE)
-		pages[i] = vmalloc_to_page(ptr);
-	ret = sg_alloc_table_from_pages(&trigger5->transfer_sgt, pages,
-					num_pages, 0, len, GFP_KERNEL);
-	kfree(pages);
+	cpp = trigger5->wire_bpp / 8;
+
+	/*
+	 * Use the next buffer in the ring if it is free. Otherwise replace
+	 * the newest queued frame, carrying its damage over so only the
+	 * latest content goes out. Waiting is left for when every buffer
+	 * has started on the wire.
+	 */
+	frame = &trigger5->frames[trigger5->fill_index];
+	if (!try_wait_for_completion(&frame->complete)) {
+		frame = trigger5_reclaim_frame(trigger5);
+		if (frame) {
+			atomic64_inc(&trigger5->stats.frames_coalesced);
+			// Its segments never went out, so reuse their counters
+			trigger5->frame_counter = frame->counter;
+			num_carried = frame->num_rects;
+			memcpy(carried, frame->rects,
+			       num_carried * sizeof(*carried));
+		} else {
+			frame = &trigger5->frames[trigger5->fill_index];
+			atomic64_inc(&trigger5->stats.ring_waits);
+			start = ktime_get_ns();
+			ret = wait_for_completion_timeout(
+				&frame->complete, msecs_to_jiffies(1000));
+			atomic64_add(ktime_get_ns() - start,
+				     &trigger5->stats.ring_wait_ns);
+			if (!ret) {
+				atomic64_inc(&trigger5->stats.frames_dropped);
+				trigger5_diff_invalidate(trigger5);
+				return;
+			}
+		}
+	}
+	trigger5_release_framebuffer(frame);
+	frame->commit_time = snap->time;
+	start = ktime_get_ns();
+
+	if (READ_ONCE(trigger5->queued))
+		atomic64_inc(&trigger5->stats.frames_overlapped);
+
+	ret = drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE);
+	if (ret < 0) {
+		goto err_release;
+	}
+
+	if (diff && num_rects)
+		num_rects = trigger5_diff_rects(trigger5, fb, map, &snap->src,
+						rects, num_rects);
+
+	/*
+	 * The diff already took the carried damage as sent, and the cursor
+	 * regions are not in the framebuffer, so add both after it.
+	 */
+	drm_rect_init(&clip, 0, 0, fb->width, fb->height);
+	for (i = 0; i < num_carried; i++)
+		if (drm_rect_intersect(&carried[i], &clip))
+			trigger5_add_rect(rects, &num_rects, &carried[i]);
+	for (i = 0; i < snap->num_forced; i++)
+		if (drm_rect_intersect(&snap->forced[i], &clip))
+			trigger5_add_rect(rects, &num_rects, &snap->forced[i]);
+	if (num_carried || snap->num_forced)
+		num_rects = trigger5_merge_rects(rects, num_rects, cpp);
+
+	if (!num_rects) {
+		// Nothing actually changed
+		drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+		complete(&frame->complete);
+		return;
+	}
+	frame->counter = trigger5->frame_counter & 0xfff;
+
+	if (trigger5_can_zero_copy(trigger5, snap, rects, num_rects)) {
+		drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+
+		trace_trigger5_convert_begin(frame->counter, 1);
+		ret = trigger5_map_framebuffer(frame, fb, &rects[0]);
+		if (ret < 0)
+			goto err_release;
+		trace_trigger5_damage(frame->counter, &rects[0], ret);
+
+		trigger5_fill_bulk_header(frame->header,
+					  trigger5->frame_counter++, &rects[0],
+					  ret - sizeof(*frame->header));
+		atomic64_inc(&trigger5->stats.frames_zero_copy);
+		atomic64_inc(&trigger5->stats.rects_sent);
+		trigger5_hist_add(&trigger5->stats.convert_time,
+				  ktime_get_ns() - start);
+		trace_trigger5_convert_end(frame->counter, ret, true);
+		frame->rects[0] = rects[0];
+		frame->num_rects = 1;
+		trigger5_queue_frame(trigger5, &frame->zc_sgt, ret,
+				     snap->event);
+		snap->event = NULL;
+		return;
+	}
+
+	// One header and payload segment per rectangle in a single transfer
+	len = 0;
+	for (i = 0; i < num_rects; i++)
+		len += trigger5_rect_cost(&rects[i], cpp);
+
+	// Overlapping rectangles can add up to more than the whole screen
+	if (len > trigger5->max_frame_len) {
+		for (i = 1; i < num_rects; i++)
+			trigger5_rect_union(&rects[0], &rects[0], &rects[i]);
+		num_rects = 1;
+		len = trigger5_rect_cost(&rects[0], cpp);
+	}
+
+	for (i = 0; i < num_rects; i++)
+		trace_trigger5_damage(frame->counter, &rects[i],
+				      trigger5_rect_cost(&rects[i], cpp));
+
+	trace_trigger5_convert_begin(frame->counter, num_rects);
+	ret = trigger5_alloc_bulk_buffer(trigger5, frame, len);
 	if (ret) {
-		goto err_vfree;
+		drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+		goto err_release;
 	}
 
-	trigger5->frame_len = len;
-	trigger5->frame_data = data;
+	memcpy(frame->rects, rects, num_rects * sizeof(*rects));
+	frame->num_rects = num_rects;
+
+	/*
+	 * Queue the frame up front and convert it in blocks of a few URBs,
+	 * so the first rows are on the wire while the rest converts.
+	 */
+	trigger5_begin_frame(trigger5, &frame->sgt, len, snap->event);
+	snap->event = NULL;
+	block = TRIGGER5_STREAM_URBS * trigger5->urb_size;
+	for (i = 0, offset = 0; i < num_rects; i++) {
+		header = (struct trigger5_bulk_header *)(frame->data + offset);
+		trigger5_fill_bulk_header(header, trigger5->frame_counter++,
+					  &rects[i],
+					  trigger5_rect_cost(&rects[i], cpp) -
+						  sizeof(*header));
+		offset += sizeof(*header);
+
+		pitch = drm_rect_width(&rects[i]) * cpp;
+		rows = max(block / pitch, 1U);
+		for (y = rects[i].y1; y < rects[i].y2; y += rows) {
+			drm_rect_init(&clip, rects[i].x1, y,
+				      drm_rect_width(&rects[i]),
+				      min_t(int, rows, rects[i].y2 - y));
+			iosys_map_set_vaddr(&data_map, frame->data + offset);
+			trigger5_convert_rect(trigger5, &data_map, map, fb,
+					      &clip);
+			trigger5_cursor_compose(trigger5, &snap->cursor,
+						frame->data + offset, &clip);
+			offset += drm_rect_height(&clip) * pitch;
+			trigger5_frame_ready(trigger5, frame, offset);
+		}
+	}
 
-	return 0;
-	sg_free_table(&trigger5->transfer_sgt);
-err_vfree:
-	vfree(data);
-	return ret;
+	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+
+	atomic64_add(num_rects, &trigger5->stats.rects_sent);
+	trigger5_hist_add(&trigger5->stats.convert_time, ktime_get_ns() - start);
+	trace_trigger5_convert_end(frame->counter, len, false);
+	return;
+
+err_release:
+	atomic64_inc(&trigger5->stats.frames_dropped);
+	trigger5_diff_invalidate(trigger5);
+	complete(&frame->complete);
+}
+
+static void trigger5_send_event(struct trigger5_device *trigger5,
+				struct drm_pending_vblank_event *event)
+{
+	struct drm_crtc *crtc = &trigger5->display_pipe.crtc;
+
+	if (!event)
+		return;
+
+	spin_lock_irq(&crtc->dev->event_lock);
+	drm_crtc_send_vblank_event(crtc, event);
+	spin_unlock_irq(&crtc->dev->event_lock);
 }
 
-static void trigger5_transfer_work(struct work_struct *work)
+static void trigger5_update_work(struct kthread_work *work)
 {
+	struct trigger5_update *update =
+		container_of(work, struct trigger5_update, work);
 	struct trigger5_device *trigger5 =
-		container_of(work, struct trigger5_device, transfer_work);
-	struct usb_device *usbdev = interface_to_usbdev(trigger5->intf);
+		container_of(update, struct trigger5_device, update);
+	struct trigger5_snapshot *snap, *pending;
+	struct iosys_map map[DRM_FORMAT_MAX_PLANES];
+	struct iosys_map data[DRM_FORMAT_MAX_PLANES];
+
+	// A depth switch is draining the ring and queues the worker after
+	if (READ_ONCE(trigger5->switching))
+		return;
+
+	// Take the snapshot, commits from here on fill in the other one
+	spin_lock_irq(&update->lock);
+	swap(update->pending, update->taken);
+	snap = update->taken;
+	pending = update->pending;
+	pending->fb = NULL;
+	pending->num_damage = 0;
+	pending->num_forced = 0;
+	pending->event = NULL;
+	spin_unlock_irq(&update->lock);
+
+	if (!snap->fb)
+		return;
+
+	// Mapped here rather than in the commit, which must not take locks
+	if (drm_gem_fb_vmap(snap->fb, map, data)) {
+		atomic64_inc(&trigger5->stats.frames_dropped);
+		trigger5_diff_invalidate(trigger5);
+	} else {
+		trigger5_send_update(trigger5, snap, &data[0]);
+		drm_gem_fb_vunmap(snap->fb, map);
+	}
 
-	// Submit bulk transfer with timeout of 5 seconds
-	usb_sg_init(&trigger5->sgr, usbdev, usb_sndbulkpipe(usbdev, 0x01), 0,
-		    trigger5->transfer_sgt.sgl, trigger5->transfer_sgt.nents,
-		    trigger5->frame_len, GFP_KERNEL);
-	mod_timer(&trigger5->timer, jiffies + msecs_to_jiffies(5000));
-	usb_sg_wait(&trigger5->sgr);
-	del_timer_sync(&trigger5->timer);
-	complete(&trigger5->frame_complete);
+	// Nothing was queued, so there is nothing to wait for
+	trigger5_send_event(trigger5, snap->event);
+	snap->event = NULL;
+
+	// Kept so a depth switch can resend the screen without a commit
+	if (update->last_fb)
+		drm_framebuffer_put(update->last_fb);
+	update->last_fb = snap->fb;
+	snap->fb = NULL;
 }
 
-static void trigger5_pipe_update(struct drm_simple_display_pipe *pipe,
-				 struct drm_plane_state *old_state)
+/*
+ * Reprogram the current mode at the depth output_bpp and the quality
+ * controller ask for. Queued frames were encoded for the old depth, so
+ * updates are held back while they drain, then the whole screen is resent.
+ * A drain that fails backs off before the next attempt.
+ */
+static void trigger5_depth_work(struct work_struct *work)
 {
-	struct drm_plane_state *state = pipe->plane.state;
-	struct drm_shadow_plane_state *shadow_plane_state =
-		to_drm_shadow_plane_state(state);
-	struct drm_rect current_rect;
-	struct trigger5_device *trigger5 = to_trigger5(pipe->crtc.dev);
-	struct trigger5_bulk_header *header;
-	int width, height, ret;
-	struct iosys_map data_map;
+	struct trigger5_device *trigger5 =
+		container_of(work, struct trigger5_device, depth_work);
+	struct trigger5_update *update = &trigger5->update;
+	unsigned int bpp = trigger5_wanted_bpp(trigger5);
+	struct trigger5_snapshot *pending;
 
-	if (drm_atomic_helper_damage_merged(old_state, state, &current_rect)) {
-		// Wait for previous frame to finish
+	if (!READ_ONCE(trigger5->enabled) || bpp == trigger5->wire_bpp ||
+	    bpp == trigger5->missing_bpp)
+		return;
 
-		wait_for_completion_timeout(
-			&trigger5->frame_complete, msecs_to_jiffies(1000));
-		
-		width = drm_rect_width(&current_rect);
-		height = drm_rect_height(&current_rect);
+	// Not worth a drain when the mode has no variant at that depth
+	if (trigger5_find_mode(&trigger5->mode_list, &trigger5->mode,
+			       bpp) < 0) {
+		trigger5->missing_bpp = bpp;
+		return;
+	}
 
-		ret = trigger5_alloc_bulk_buffer(
-			trigger5, width * height * 3 +
-					  sizeof(struct trigger5_bulk_header));
-		if (ret) {
-			return;
-		}
+	// Let an update still converting at the old depth finish first
+	WRITE_ONCE(trigger5->switching, true);
+	kthread_flush_work(&update->work);
+
+	if (!trigger5_drain_frames(trigger5)) {
+		trigger5->depth_backoff_ms =
+			clamp_t(unsigned int, trigger5->depth_backoff_ms * 2,
+				TRIGGER5_DEPTH_RETRY_MIN_MS,
+				TRIGGER5_DEPTH_RETRY_MAX_MS);
+		trigger5->depth_retry =
+			jiffies + msecs_to_jiffies(trigger5->depth_backoff_ms);
+		drm_dbg(&trigger5->drm,
+			"ring did not drain, switching to %u bpp in %u ms\n",
+			bpp, trigger5->depth_backoff_ms);
+		goto out;
+	}
 
-		// Only full screen updates work
-		header = (struct trigger5_bulk_header *)trigger5->frame_data;
-		header->magic = 0xfb;
-		header->length = 0x14;
-		header->counter = (trigger5->frame_counter++) & 0xfff;
-		header->horizontal_offset = cpu_to_le16(current_rect.x1);
-		header->vertical_offset = cpu_to_le16(current_rect.y1);
-		header->width = cpu_to_le16(width);
-		header->height = cpu_to_le16(height);
-		header->payload_length = cpu_to_le32(width * height * 3);
-		header->flags = 0x1;
-		header->unknown1 = 0;
-		header->unknown2 = 0;
-		header->checksum = trigger5_bulk_header_checksum(header);
-
-		iosys_map_set_vaddr(
-			&data_map, trigger5->frame_data +
-					   sizeof(struct trigger5_bulk_header));
-
-		ret = drm_gem_fb_begin_cpu_access(state->fb, DMA_FROM_DEVICE);
-		if (ret < 0) {
-			return;
+	trigger5_program_mode(trigger5, &trigger5->mode, bpp);
+	trigger5_diff_invalidate(trigger5);
+	trigger5->depth_backoff_ms = 0;
+	update->resend = true;
+
+	// Without a commit waiting, resend the last framebuffer sent
+	spin_lock_irq(&update->lock);
+	pending = update->pending;
+	if (!pending->fb && update->last_fb) {
+		drm_framebuffer_get(update->last_fb);
+		pending->fb = update->last_fb;
+		pending->src = update->taken->src;
+		pending->cursor = update->taken->cursor;
+		pending->time = ktime_get_ns();
+	}
+	spin_unlock_irq(&update->lock);
+
+out:
+	WRITE_ONCE(trigger5->switching, false);
+	kthread_queue_work(trigger5->worker, &update->work);
+}
+
+/*
+ * Send rectangles of the primary framebuffer, with the cursor composed on
+ * top, and complete the commit's flip once they are on the wire. Shared by
+ * the primary and cursor planes. Only takes a snapshot of the update, the
+ * worker converts and queues it.
+ */
+void trigger5_run_update(struct trigger5_device *trigger5,
+			 struct drm_framebuffer *fb,
+			 const struct drm_rect *rects, unsigned int num_rects,
+			 bool diff)
+{
+	struct trigger5_update *update = &trigger5->update;
+	struct trigger5_snapshot *pending;
+	struct drm_crtc *crtc = &trigger5->display_pipe.crtc;
+	struct drm_pending_vblank_event *event, *replaced = NULL;
+	struct drm_framebuffer *old_fb;
+	unsigned int i;
+
+	spin_lock_irq(&crtc->dev->event_lock);
+	event = crtc->state->event;
+	crtc->state->event = NULL;
+	spin_unlock_irq(&crtc->dev->event_lock);
+
+	if (!fb) {
+		trigger5_send_event(trigger5, event);
+		return;
+	}
+
+	drm_framebuffer_get(fb);
+	spin_lock_irq(&update->lock);
+	pending = update->pending;
+	old_fb = pending->fb;
+	if (old_fb) {
+		// The worker has not taken the last one yet, so replace it
+		atomic64_inc(&trigger5->stats.frames_coalesced);
+		if (event) {
+			// Its content is superseded, so is its flip
+			replaced = pending->event;
+			pending->event = event;
 		}
+	} else {
+		pending->time = ktime_get_ns();
+		pending->event = event;
+	}
+	pending->fb = fb;
+	pending->src = trigger5->display_pipe.plane.state->src;
+	// The cursor plane moves on while the worker composes this copy
+	if (pending->cursor.seq != trigger5->cursor.image.seq)
+		pending->cursor = trigger5->cursor.image;
+	for (i = 0; i < num_rects; i++) {
+		if (diff)
+			trigger5_add_rect(pending->damage, &pending->num_damage,
+					  &rects[i]);
+		else
+			trigger5_add_rect(pending->forced, &pending->num_forced,
+					  &rects[i]);
+	}
+	if (old_fb) {
+		pending->num_damage = trigger5_merge_rects(
+			pending->damage, pending->num_damage,
+			trigger5->wire_bpp / 8);
+		pending->num_forced = trigger5_merge_rects(
+			pending->forced, pending->num_forced,
+			trigger5->wire_bpp / 8);
+	}
+	spin_unlock_irq(&update->lock);
 
-		drm_fb_xrgb8888_to_rgb888(&data_map, NULL,
-					  &shadow_plane_state->data[0],
-					  state->fb, &current_rect);
+	if (old_fb)
+		drm_framebuffer_put(old_fb);
+	trigger5_send_event(trigger5, replaced);
 
-		drm_gem_fb_end_cpu_access(state->fb, DMA_FROM_DEVICE);
+	// Convert on the device's own worker, off the commit path
+	kthread_queue_work(trigger5->worker, &update->work);
+}
 
-		queue_work(system_highpri_wq, &trigger5->transfer_work);
+// Drop what the worker still holds, once the worker is gone
+void trigger5_release_update(struct trigger5_device *trigger5)
+{
+	struct trigger5_snapshot *pending = trigger5->update.pending;
 
-		/*usb_control_msg(
-			interface_to_usbdev(trigger5->intf),
-			usb_rcvctrlpipe(interface_to_usbdev(trigger5->intf), 0),
-			0x91, USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
-			0x0002, 0x0000, data, 1, USB_CTRL_SET_TIMEOUT);*/
+	if (trigger5->update.last_fb) {
+		drm_framebuffer_put(trigger5->update.last_fb);
+		trigger5->update.last_fb = NULL;
 	}
+	if (!pending->fb)
+		return;
+	if (pending->event)
+		drm_event_cancel_free(&trigger5->drm, &pending->event->base);
+	drm_framebuffer_put(pending->fb);
+	pending->event = NULL;
+	pending->fb = NULL;
+}
+
+static void trigger5_pipe_update(struct drm_simple_display_pipe *pipe,
+				 struct drm_plane_state *old_state)
+{
+	struct trigger5_device *trigger5 = to_trigger5(pipe->crtc.dev);
+	struct drm_plane_state *state = pipe->plane.state;
+	struct drm_rect rects[TRIGGER5_MAX_DAMAGE_RECTS];
+	unsigned int num_rects;
+
+	num_rects = trigger5_damage_rects(old_state, state, rects,
+					  trigger5->wire_bpp / 8);
+	trigger5_run_update(trigger5, state->fb, rects, num_rects, true);
 }
 
 static const struct drm_simple_display_pipe_funcs trigger5_pipe_funcs = {
@@ -431,13 +1021,37 @@ static const struct drm_simple_display_pipe_funcs trigger5_pipe_funcs = {
 	.check = trigger5_pipe_check,
 	.mode_valid = trigger5_pipe_mode_valid,
 	.update = trigger5_pipe_update,
+	.enable_vblank = trigger5_pipe_enable_vblank,
+	.disable_vblank = trigger5_pipe_disable_vblank,
 	DRM_GEM_SIMPLE_DISPLAY_PIPE_SHADOW_PLANE_FUNCS,
 };
 
 static const uint32_t trigger5_pipe_formats[] = {
 	DRM_FORMAT_XRGB8888,
+	DRM_FORMAT_ARGB8888,
+	DRM_FORMAT_XBGR8888,
+	DRM_FORMAT_ABGR8888,
+	DRM_FORMAT_RGB888,
+	DRM_FORMAT_RGB565,
 };
 
+/*
+ * fbdev setup reads the EDID, validates every mode against the PLL and sets
+ * the first one, all over control transfers. Doing it here keeps it off the
+ * enumeration path, so many adapters come up in parallel.
+ */
+static void trigger5_init_work(struct work_struct *work)
+{
+	struct trigger5_device *trigger5 =
+		container_of(work, struct trigger5_device, init_work);
+
+	drm_fbdev_generic_setup(&trigger5->drm, 0);
+
+	trigger5->boot.initialised = ktime_get_ns() - trigger5->boot.start;
+	drm_dbg(&trigger5->drm, "initialised %llu ms after probe\n",
+		div_u64(trigger5->boot.initialised, NSEC_PER_MSEC));
+}
+
 static int trigger5_usb_probe(struct usb_interface *interface,
 			      const struct usb_device_id *id)
 {
@@ -455,6 +1069,7 @@ static int trigger5_usb_probe(struct usb_interface *interface,
 	if (IS_ERR(trigger5))
 		return PTR_ERR(trigger5);
 
+	trigger5->boot.start = ktime_get_ns();
 	trigger5->intf = interface;
 	dev = &trigger5->drm;
 
@@ -490,13 +1105,29 @@ static int trigger5_usb_probe(struct usb_interface *interface,
 	dev->mode_config.funcs = &trigger5_mode_config_funcs;
 
 	trigger5->frame_counter = 0;
-	trigger5->frame_len = 0;
+	spin_lock_init(&trigger5->pll_lock);
+	trigger5->wire_bpp = 24;
+	trigger5->max_frame_len =
+		max_width * max_height * 3 +
+		TRIGGER5_MAX_DAMAGE_RECTS * sizeof(struct trigger5_bulk_header);
+
+	kthread_init_work(&trigger5->update.work, trigger5_update_work);
+	INIT_WORK(&trigger5->depth_work, trigger5_depth_work);
+	spin_lock_init(&trigger5->update.lock);
+	trigger5->update.pending = &trigger5->update.snapshots[0];
+	trigger5->update.taken = &trigger5->update.snapshots[1];
+	INIT_WORK(&trigger5->init_work, trigger5_init_work);
+	ret = trigger5_transfer_init(trigger5);
+	if (ret)
+		goto err_put_device;
 
-	init_completion(&trigger5->frame_complete);
-	complete(&trigger5->frame_complete);
+	ret = trigger5_diff_init(trigger5);
+	if (ret)
+		goto err_put_device;
 
-	timer_setup(&trigger5->timer, trigger5_bulk_timeout, 0);
-	INIT_WORK(&trigger5->transfer_work, trigger5_transfer_work);
+	ret = trigger5_convert_init(trigger5);
+	if (ret)
+		goto err_put_device;
 
 	// Presence of audio interfaces = HDMI
 	ret = trigger5_connector_init(trigger5,
@@ -515,6 +1146,20 @@ static int trigger5_usb_probe(struct usb_interface *interface,
 
 	drm_plane_enable_fb_damage_clips(&trigger5->display_pipe.plane);
 
+	ret = trigger5_cursor_init(trigger5);
+	if (ret)
+		goto err_put_device;
+
+	hrtimer_init(&trigger5->vblank_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	trigger5->vblank_timer.function = trigger5_vblank_timer;
+	ret = drmm_add_action_or_reset(dev, trigger5_vblank_release, NULL);
+	if (ret)
+		goto err_put_device;
+
+	ret = drm_vblank_init(dev, 1);
+	if (ret)
+		goto err_put_device;
+
 	drm_mode_config_reset(dev);
 
 	usb_set_intfdata(interface, trigger5);
@@ -525,7 +1170,10 @@ static int trigger5_usb_probe(struct usb_interface *interface,
 	if (ret)
 		goto err_put_device;
 
-	drm_fbdev_generic_setup(dev, 0);
+	trigger5_hpd_start(trigger5);
+
+	trigger5->boot.probed = ktime_get_ns() - trigger5->boot.start;
+	queue_work(system_unbound_wq, &trigger5->init_work);
 
 	return 0;
 
@@ -539,12 +1187,14 @@ static void trigger5_usb_disconnect(struct usb_interface *interface)
 	struct trigger5_device *trigger5 = usb_get_intfdata(interface);
 	struct drm_device *dev = &trigger5->drm;
 
+	cancel_work_sync(&trigger5->init_work);
+	trigger5_hpd_stop(trigger5);
 	drm_kms_helper_poll_fini(dev);
 	drm_dev_unplug(dev);
 	drm_atomic_helper_shutdown(dev);
+	trigger5_transfer_stop(trigger5);
 	put_device(trigger5->dmadev);
 	trigger5->dmadev = NULL;
-	trigger5_free_bulk_buffer(trigger5);
 }
 
 static const struct usb_device_id id_table[] = {
@@ -616,13 +1266,65 @@ static const struct usb_device_id id_table[] = {
 };
 MODULE_DEVICE_TABLE(usb, id_table);
 
+static ssize_t worker_cpus_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct trigger5_device *trigger5 = dev_get_drvdata(dev);
+
+	return cpumap_print_to_pagebuf(true, buf,
+				       trigger5->worker->task->cpus_ptr);
+}
+
+static ssize_t worker_cpus_store(struct device *dev,
+				 struct device_attribute *attr, const char *buf,
+				 size_t count)
+{
+	struct trigger5_device *trigger5 = dev_get_drvdata(dev);
+	cpumask_var_t mask;
+	unsigned int i;
+	int ret;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	// Stripes follow the frame worker, so one mask bounds the whole update
+	ret = cpulist_parse(buf, mask);
+	if (!ret)
+		ret = set_cpus_allowed_ptr(trigger5->worker->task, mask);
+	for (i = 0; !ret && i < trigger5->num_stripe_workers; i++)
+		ret = set_cpus_allowed_ptr(trigger5->stripe_workers[i]->task,
+					   mask);
+	free_cpumask_var(mask);
+
+	return ret ?: count;
+}
+static DEVICE_ATTR_RW(worker_cpus);
+
+static struct attribute *trigger5_attrs[] = {
+	&dev_attr_worker_cpus.attr,
+	NULL,
+};
+
+static const struct attribute_group trigger5_group = {
+	.attrs = trigger5_attrs,
+};
+
+static const struct attribute_group *trigger5_groups[] = {
+	&trigger5_group,
+	&trigger5_quality_group,
+	NULL,
+};
+
 static struct usb_driver trigger5_driver = {
 	.name = "trigger5",
+	.dev_groups = trigger5_groups,
 	.probe = trigger5_usb_probe,
 	.disconnect = trigger5_usb_disconnect,
 	.suspend = trigger5_usb_suspend,
 	.resume = trigger5_usb_resume,
 	.id_table = id_table,
+	// Probing one adapter must not hold up enumeration of the others
+	.drvwrap.driver.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 };
 module_usb_driver(trigger5_driver);
 MODULE_LICENSE("GPL");
@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/hash.h>
+#include <linux/once.h>
+
+#include "trigger5.h"
+
+/*
+ * The output clock is ref * mul1 * mul2 / prediv / div1 / div2, truncated at
+ * every step. Chained integer divisions by positive numbers equal a single
+ * division by their product, so the clock only depends on the multiplier
+ * product M = mul1 * mul2 and the divider product D = prediv * div1 * div2.
+ *
+ * For a fixed D the clock grows with M, so the best M is one of the two
+ * reachable products around target * D / ref. That replaces the inner
+ * mul1/mul2 loops with a short scan of a table of reachable products.
+ */
+#define TRIGGER5_PLL_REF_CLOCK	10000000ULL
+#define TRIGGER5_PLL_MAX_MUL	0x32
+#define TRIGGER5_PLL_MAX_DIV1	0x32
+#define TRIGGER5_PLL_MAX_PRODUCT (TRIGGER5_PLL_MAX_MUL * TRIGGER5_PLL_MAX_MUL)
+
+// Smallest mul1 giving each product, 0 when the product is unreachable
+static u8 trigger5_pll_mul1[TRIGGER5_PLL_MAX_PRODUCT + 1];
+
+static void trigger5_pll_init_table(void)
+{
+	int mul1, mul2;
+
+	for (mul1 = TRIGGER5_PLL_MAX_MUL; mul1 >= 1; mul1--)
+		for (mul2 = 1; mul2 <= TRIGGER5_PLL_MAX_MUL; mul2++)
+			trigger5_pll_mul1[mul1 * mul2] = mul1;
+}
+
+struct trigger5_pll_candidate {
+	u64 err;
+	struct trigger5_pll pll;
+};
+
+/*
+ * The brute force search kept the first best result in loop order, so ties
+ * go to the lexicographically smallest (prediv, mul1, mul2, div1, div2).
+ */
+static bool trigger5_pll_better(const struct trigger5_pll_candidate *a,
+				const struct trigger5_pll_candidate *b)
+{
+	if (a->err != b->err)
+		return a->err < b->err;
+	if (a->pll.unknown != b->pll.unknown)
+		return a->pll.unknown < b->pll.unknown;
+	if (a->pll.mul1 != b->pll.mul1)
+		return a->pll.mul1 < b->pll.mul1;
+	if (a->pll.mul2 != b->pll.mul2)
+		return a->pll.mul2 < b->pll.mul2;
+	if (a->pll.div1 != b->pll.div1)
+		return a->pll.div1 < b->pll.div1;
+	return a->pll.div2 < b->pll.div2;
+}
+
+static void trigger5_pll_try(struct trigger5_pll_candidate *best, u64 target,
+			     unsigned int product, int prediv, int div1,
+			     int div2)
+{
+	struct trigger5_pll_candidate cand;
+	u64 clock = TRIGGER5_PLL_REF_CLOCK * product /
+		    (prediv * div1 * div2);
+
+	cand.err = clock > target ? clock - target : target - clock;
+	cand.pll.unknown = prediv;
+	cand.pll.mul1 = trigger5_pll_mul1[product];
+	cand.pll.mul2 = product / cand.pll.mul1;
+	cand.pll.div1 = div1;
+	cand.pll.div2 = div2;
+
+	if (trigger5_pll_better(&cand, best))
+		*best = cand;
+}
+
+u64 trigger5_calculate_pll(struct trigger5_pll *pll, int clock)
+{
+	struct trigger5_pll_candidate best = { .err = U64_MAX };
+	u64 target_clock = (u64)clock * 1000;
+	unsigned int product, below;
+	int prediv, div1, div2, div;
+	u64 limit;
+
+	DO_ONCE(trigger5_pll_init_table);
+
+	// Use values found in the capture
+	for (prediv = 1; prediv <= 0x10; prediv <<= 1) {
+		for (div1 = 1; div1 <= TRIGGER5_PLL_MAX_DIV1; div1++) {
+			for (div2 = 0x02; div2 <= 0x10; div2 <<= 1) {
+				div = prediv * div1 * div2;
+
+				// Largest product whose clock is <= target
+				limit = ((target_clock + 1) * div - 1) /
+					TRIGGER5_PLL_REF_CLOCK;
+				below = min_t(u64, limit,
+					      TRIGGER5_PLL_MAX_PRODUCT);
+				while (below && !trigger5_pll_mul1[below])
+					below--;
+				if (below)
+					trigger5_pll_try(&best, target_clock,
+							 below, prediv, div1,
+							 div2);
+
+				// Smallest product whose clock is > target
+				for (product = below + 1;
+				     product <= TRIGGER5_PLL_MAX_PRODUCT;
+				     product++) {
+					if (!trigger5_pll_mul1[product])
+						continue;
+					trigger5_pll_try(&best, target_clock,
+							 product, prediv, div1,
+							 div2);
+					break;
+				}
+			}
+		}
+	}
+
+	*pll = best.pll;
+	return best.err;
+}
+
+/*
+ * Results are cached per pixel clock since every probe revalidates modes.
+ * A monitor lists a few dozen clocks, so clocks that hash to the same set
+ * share it, and the least recently used one makes room for a new clock.
+ */
+u64 trigger5_get_pll(struct trigger5_device *trigger5, struct trigger5_pll *pll,
+		     int clock)
+{
+	struct trigger5_pll_cache_entry *set =
+		trigger5->pll_cache[hash_32(clock, TRIGGER5_PLL_CACHE_BITS)];
+	struct trigger5_pll_cache_entry *entry;
+	unsigned int i;
+	u64 err;
+
+	spin_lock(&trigger5->pll_lock);
+	for (i = 0; i < TRIGGER5_PLL_CACHE_WAYS; i++) {
+		if (set[i].clock == clock) {
+			set[i].used = ++trigger5->pll_cache_stamp;
+			*pll = set[i].pll;
+			err = set[i].err;
+			spin_unlock(&trigger5->pll_lock);
+			atomic64_inc(&trigger5->stats.pll_cache_hits);
+			return err;
+		}
+	}
+	spin_unlock(&trigger5->pll_lock);
+
+	atomic64_inc(&trigger5->stats.pll_cache_misses);
+	err = trigger5_calculate_pll(pll, clock);
+
+	// Another caller may have added the clock meanwhile, reuse its entry
+	spin_lock(&trigger5->pll_lock);
+	entry = &set[0];
+	for (i = 0; i < TRIGGER5_PLL_CACHE_WAYS; i++) {
+		if (set[i].clock == clock) {
+			entry = &set[i];
+			break;
+		}
+		if ((s32)(set[i].used - entry->used) < 0)
+			entry = &set[i];
+	}
+	entry->clock = clock;
+	entry->pll = *pll;
+	entry->err = err;
+	entry->used = ++trigger5->pll_cache_stamp;
+	spin_unlock(&trigger5->pll_lock);
+
+	return err;
+}
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <drm/drm_modes.h>
+
+#include "trigger5.h"
+
+/*
+ * Encoding of the device's control requests and bulk headers. Nothing here
+ * touches the device, so it can be checked and timed on its own.
+ */
+
+static u8 trigger5_checksum(const u8 *data, unsigned int len)
+{
+	u8 sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		sum += data[i];
+	return -sum;
+}
+
+// Makes the bytes of the header, checksum included, add up to zero
+u8 trigger5_bulk_header_checksum(const struct trigger5_bulk_header *header)
+{
+	return trigger5_checksum((const u8 *)header,
+				 sizeof(struct trigger5_bulk_header) - 1);
+}
+
+void trigger5_fill_bulk_header(struct trigger5_bulk_header *header,
+			       u16 counter, const struct drm_rect *rect,
+			       unsigned int payload_length)
+{
+	header->magic = 0xfb;
+	header->length = 0x14;
+	header->counter = cpu_to_le16(counter & 0xfff);
+	header->horizontal_offset = cpu_to_le16(rect->x1);
+	header->vertical_offset = cpu_to_le16(rect->y1);
+	header->width = cpu_to_le16(drm_rect_width(rect));
+	header->height = cpu_to_le16(drm_rect_height(rect));
+	header->payload_length = cpu_to_le32(payload_length);
+	header->flags = 0x1;
+	header->unknown1 = 0;
+	header->unknown2 = 0;
+	header->checksum = trigger5_bulk_header_checksum(header);
+}
+
+// The mode list reports 16 for RGB565 modes, anything else is sent as RGB888
+static unsigned int trigger5_mode_bpp(const struct trigger5_mode *trigger5_mode)
+{
+	return trigger5_mode->bpp == 16 ? 16 : 24;
+}
+
+/*
+ * Returns the mode number for the mode at the requested depth, or -ENOENT
+ * when the device does not list a 16 bpp variant of it.
+ */
+int trigger5_find_mode(const struct trigger5_mode_list *mode_list,
+		       const struct drm_display_mode *mode, unsigned int bpp)
+{
+	unsigned int num_modes = min((u16)52, be16_to_cpu(mode_list->count));
+	unsigned int i;
+
+	for (i = 0; i < num_modes; i++) {
+		const struct trigger5_mode *trigger5_mode =
+			&mode_list->modes[i];
+
+		if (le16_to_cpu(trigger5_mode->width) == mode->hdisplay &&
+		    le16_to_cpu(trigger5_mode->height) == mode->vdisplay &&
+		    trigger5_mode->hz == drm_mode_vrefresh(mode) &&
+		    trigger5_mode_bpp(trigger5_mode) == bpp)
+			return trigger5_mode->mode_number;
+	}
+
+	if (bpp == 16)
+		return -ENOENT;
+
+	// Any mode is supported by setting the right parameters
+	// Return the last mode number
+	return mode_list->modes[num_modes - 1].mode_number;
+}
+
+// Timings of a SET_MODE request, the PLL is filled in separately
+void trigger5_fill_mode_request(struct trigger6_mode_request *request,
+				const struct drm_display_mode *mode)
+{
+	request->height = cpu_to_be16(mode->vdisplay);
+	request->height_minus_one = cpu_to_be16(mode->vdisplay - 1);
+	request->width = cpu_to_be16(mode->hdisplay);
+	request->width_minus_one = cpu_to_be16(mode->hdisplay - 1);
+
+	request->line_total_pixels = cpu_to_be16(mode->htotal - 1);
+	request->line_sync_pulse =
+		cpu_to_be16(mode->hsync_end - mode->hsync_start - 1);
+	request->line_back_porch =
+		cpu_to_be16(mode->htotal - mode->hsync_end - 1);
+
+	request->frame_total_lines = cpu_to_be16(mode->vtotal - 1);
+	request->frame_sync_pulse =
+		cpu_to_be16(mode->vsync_end - mode->vsync_start - 1);
+	request->frame_back_porch =
+		cpu_to_be16(mode->vtotal - mode->vsync_end - 1);
+	request->unknown1 = 0xff;
+	request->unknown2 = 0xff;
+	request->unknown3 = 0xff;
+	request->unknown4 = 0xff;
+
+	request->hsync_polarity =
+		(mode->flags & DRM_MODE_FLAG_PHSYNC) ? 0 : 1;
+	request->vsync_polarity =
+		(mode->flags & DRM_MODE_FLAG_PVSYNC) ? 0 : 1;
+}
+
+// Modes whose clock the PLL can't get close enough to are not offered
+enum drm_mode_status trigger5_pll_mode_status(u64 err, int clock)
+{
+	u64 ppm = div_u64(err * 1000000, clock);
+
+	if (ppm > 10000)
+		return MODE_CLOCK_RANGE;
+	return MODE_OK;
+}
@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/device.h>
+#include <linux/math64.h>
+#include <linux/sysfs.h>
+
+#include "trigger5.h"
+
+// Windows in a row needed before stepping down or back up
+#define TRIGGER5_QUALITY_DOWN_WINDOWS	2
+#define TRIGGER5_QUALITY_UP_WINDOWS	5
+
+// Link load, in percent, a step up must stay under
+#define TRIGGER5_QUALITY_UP_LOAD	70
+
+static const char *const trigger5_quality_names[] = {
+	[TRIGGER5_QUALITY_FULL] = "full",
+	[TRIGGER5_QUALITY_REDUCED] = "reduced",
+	[TRIGGER5_QUALITY_CAPPED] = "capped",
+};
+
+ktime_t trigger5_quality_vblank_period(struct trigger5_device *trigger5,
+				       u64 framedur_ns)
+{
+	unsigned int fps_cap = READ_ONCE(trigger5->quality.fps_cap);
+
+	if (!framedur_ns)
+		framedur_ns = NSEC_PER_SEC / 60;
+	if (fps_cap)
+		framedur_ns = max_t(u64, framedur_ns, NSEC_PER_SEC / fps_cap);
+	return ns_to_ktime(framedur_ns);
+}
+
+static void trigger5_quality_set_locked(struct trigger5_device *trigger5,
+					enum trigger5_quality_level level,
+					unsigned int fps_cap)
+{
+	struct trigger5_quality *quality = &trigger5->quality;
+
+	quality->level = level;
+	WRITE_ONCE(quality->reduced, level != TRIGGER5_QUALITY_FULL);
+	WRITE_ONCE(quality->fps_cap, fps_cap);
+	quality->congested = 0;
+	quality->idle = 0;
+
+	// Compositors pace on vblank, so a slower clock caps the frame rate
+	WRITE_ONCE(trigger5->vblank_period,
+		   trigger5_quality_vblank_period(trigger5,
+						  trigger5->vblank_framedur_ns));
+}
+
+/*
+ * Called once per throughput window. Steps down from 24 bpp to 16 bpp and
+ * then to a capped frame rate while the link falls behind the target, and
+ * back up once the link would have room for the better setting. Both
+ * directions need several windows in a row to avoid flapping.
+ */
+void trigger5_quality_update_locked(struct trigger5_device *trigger5)
+{
+	struct trigger5_quality *quality = &trigger5->quality;
+	struct trigger5_rate *rate = &trigger5->rate;
+	unsigned int target = READ_ONCE(quality->target_fps);
+	unsigned int fps, load, fps_cap;
+
+	if (rate->busy)
+		WRITE_ONCE(quality->link_rate,
+			   div64_u64(rate->bytes * NSEC_PER_SEC, rate->busy));
+
+	if (!target || rate->frames < 2)
+		return;
+
+	fps = div64_u64((u64)rate->frames * NSEC_PER_SEC, rate->window);
+	load = div64_u64(rate->busy * 100, rate->window);
+
+	// Behind when frames got replaced or the link is saturated short of
+	// the target
+	if (rate->coalesced || (fps < target * 9 / 10 && load > 90)) {
+		quality->idle = 0;
+		if (++quality->congested < TRIGGER5_QUALITY_DOWN_WINDOWS)
+			return;
+
+		if (quality->level == TRIGGER5_QUALITY_FULL) {
+			trigger5_quality_set_locked(trigger5,
+						    TRIGGER5_QUALITY_REDUCED, 0);
+			return;
+		}
+
+		// What the link carries at the current frame size, lower
+		// than before if a cap is already not enough
+		fps_cap = div64_u64(quality->link_rate * rate->frames,
+				    rate->bytes);
+		if (quality->fps_cap)
+			fps_cap = min(fps_cap, quality->fps_cap * 3 / 4);
+		trigger5_quality_set_locked(trigger5, TRIGGER5_QUALITY_CAPPED,
+					    clamp(fps_cap, 1U, target));
+		return;
+	}
+	quality->congested = 0;
+
+	// Estimate the load one step up
+	switch (quality->level) {
+	case TRIGGER5_QUALITY_FULL:
+		return;
+	case TRIGGER5_QUALITY_REDUCED:
+		load = load * 3 / 2;
+		break;
+	case TRIGGER5_QUALITY_CAPPED:
+		load = load * target / quality->fps_cap;
+		break;
+	}
+
+	if (load >= TRIGGER5_QUALITY_UP_LOAD) {
+		quality->idle = 0;
+		return;
+	}
+	if (++quality->idle < TRIGGER5_QUALITY_UP_WINDOWS)
+		return;
+
+	trigger5_quality_set_locked(trigger5, quality->level - 1, 0);
+}
+
+static ssize_t level_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct trigger5_device *trigger5 = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%s\n",
+			  trigger5_quality_names[READ_ONCE(
+				  trigger5->quality.level)]);
+}
+static DEVICE_ATTR_RO(level);
+
+static ssize_t target_fps_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct trigger5_device *trigger5 = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(trigger5->quality.target_fps));
+}
+
+static ssize_t target_fps_store(struct device *dev,
+				struct device_attribute *attr, const char *buf,
+				size_t count)
+{
+	struct trigger5_device *trigger5 = dev_get_drvdata(dev);
+	unsigned long flags;
+	unsigned int fps;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &fps);
+	if (ret)
+		return ret;
+	if (fps > 240)
+		return -EINVAL;
+
+	// Start over from full quality for the new target
+	spin_lock_irqsave(&trigger5->queue_lock, flags);
+	WRITE_ONCE(trigger5->quality.target_fps, fps);
+	trigger5_quality_set_locked(trigger5, TRIGGER5_QUALITY_FULL, 0);
+	spin_unlock_irqrestore(&trigger5->queue_lock, flags);
+
+	return count;
+}
+static DEVICE_ATTR_RW(target_fps);
+
+static ssize_t fps_cap_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct trigger5_device *trigger5 = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(trigger5->quality.fps_cap));
+}
+static DEVICE_ATTR_RO(fps_cap);
+
+static ssize_t link_rate_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct trigger5_device *trigger5 = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%llu\n",
+			  READ_ONCE(trigger5->quality.link_rate));
+}
+static DEVICE_ATTR_RO(link_rate);
+
+static struct attribute *trigger5_quality_attrs[] = {
+	&dev_attr_level.attr,
+	&dev_attr_target_fps.attr,
+	&dev_attr_fps_cap.attr,
+	&dev_attr_link_rate.attr,
+	NULL,
+};
+
+const struct attribute_group trigger5_quality_group = {
+	.name = "quality",
+	.attrs = trigger5_quality_attrs,
+};
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/math.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/timekeeping.h>
+
+#include <drm/drm_debugfs.h>
+#include <drm/drm_file.h>
+#include <drm/drm_modes.h>
+
+#include "trigger5.h"
+
+/*
+ * Reference data and timings of the pure compute paths. The KUnit suite in
+ * trigger5_test.c checks them against this data and runs the benchmarks,
+ * which the bench debugfs file also reports on a live device.
+ */
+
+// Pixel clocks in kHz of the CEA-861 and DMT modes monitors commonly list
+const int trigger5_selftest_clocks[TRIGGER5_SELFTEST_NUM_CLOCKS] = {
+	25175, 25200, 27000, 27027, 31500, 36000, 40000, 49500, 50000,
+	54000, 54054, 56250, 65000, 68250, 71000, 74176, 74250, 75000,
+	78750, 79500, 83500, 85500, 88750, 94500, 101000, 102250, 106500,
+	108000, 108108, 115500, 117500, 119000, 121750, 122500, 135000,
+	136750, 138500, 140250, 146250, 148352, 148500, 154000, 156000,
+	157000, 157500, 162000, 173000, 175500, 187000, 189000, 193250,
+	202500, 204750, 214750, 218250, 229500, 234000, 241500, 245250,
+	245500, 261000, 268000, 268250, 281250, 296703, 297000, 317000,
+	333250, 348500, 380500, 533250, 594000,
+};
+
+const struct drm_display_mode
+	trigger5_selftest_modes[TRIGGER5_SELFTEST_NUM_MODES] = {
+	{ DRM_MODE("1920x1080", DRM_MODE_TYPE_DRIVER, 148500, 1920, 2008,
+		   2052, 2200, 0, 1080, 1084, 1089, 1125, 0,
+		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	{ DRM_MODE("1280x720", DRM_MODE_TYPE_DRIVER, 74250, 1280, 1390, 1430,
+		   1650, 0, 720, 725, 730, 750, 0,
+		   DRM_MODE_FLAG_PHSYNC | DRM_MODE_FLAG_PVSYNC) },
+	{ DRM_MODE("800x600", DRM_MODE_TYPE_DRIVER, 40000, 800, 840, 968, 1056,
+		   0, 600, 601, 605, 628, 0,
+		   DRM_MODE_FLAG_NHSYNC | DRM_MODE_FLAG_NVSYNC) },
+};
+
+#define TRIGGER5_BENCH_RUNS	8
+
+struct trigger5_bench {
+	const char *name;
+	void (*run)(const struct trigger5_mode_list *mode_list,
+		    unsigned int loops);
+	unsigned int loops;
+};
+
+static void trigger5_bench_header(const struct trigger5_mode_list *mode_list,
+				  unsigned int loops)
+{
+	struct trigger5_bulk_header header;
+	struct drm_rect rect = DRM_RECT_INIT(0, 0, 1920, 1080);
+	unsigned int i;
+
+	for (i = 0; i < loops; i++) {
+		trigger5_fill_bulk_header(&header, i, &rect, 1920 * 1080 * 3);
+		barrier_data(&header);
+	}
+}
+
+static void trigger5_bench_find_mode(const struct trigger5_mode_list *mode_list,
+				     unsigned int loops)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < loops; i++) {
+		ret = trigger5_find_mode(mode_list, &trigger5_selftest_modes[0],
+					 24);
+		barrier_data(&ret);
+	}
+}
+
+static void
+trigger5_bench_mode_request(const struct trigger5_mode_list *mode_list,
+			    unsigned int loops)
+{
+	struct trigger6_mode_request request;
+	unsigned int i;
+
+	for (i = 0; i < loops; i++) {
+		trigger5_fill_mode_request(&request,
+					   &trigger5_selftest_modes[0]);
+		barrier_data(&request);
+	}
+}
+
+// Uncached, the cost of validating a mode the first time it is seen
+static void trigger5_bench_pll(const struct trigger5_mode_list *mode_list,
+			       unsigned int loops)
+{
+	struct trigger5_pll pll;
+	unsigned int i;
+
+	for (i = 0; i < loops; i++) {
+		trigger5_calculate_pll(
+			&pll, trigger5_selftest_clocks
+				      [i % TRIGGER5_SELFTEST_NUM_CLOCKS]);
+		barrier_data(&pll);
+	}
+}
+
+static const struct trigger5_bench trigger5_benches[] = {
+	{ "bulk_header", trigger5_bench_header, 10000 },
+	{ "find_mode", trigger5_bench_find_mode, 10000 },
+	{ "mode_request", trigger5_bench_mode_request, 10000 },
+	{ "calculate_pll", trigger5_bench_pll, 64 },
+};
+
+/*
+ * Run the index-th benchmark a few times and return its best time per call
+ * in ns, or -ENOENT past the last one. The mode lookup searches mode_list.
+ */
+s64 trigger5_bench_run(unsigned int index,
+		       const struct trigger5_mode_list *mode_list,
+		       const char **name)
+{
+	const struct trigger5_bench *bench;
+	unsigned int run;
+	u64 start, best = U64_MAX;
+
+	if (index >= ARRAY_SIZE(trigger5_benches))
+		return -ENOENT;
+
+	bench = &trigger5_benches[index];
+	for (run = 0; run < TRIGGER5_BENCH_RUNS; run++) {
+		start = ktime_get_ns();
+		bench->run(mode_list, bench->loops);
+		best = min(best, ktime_get_ns() - start);
+		cond_resched();
+	}
+
+	*name = bench->name;
+	return div_u64(best, bench->loops);
+}
+
+int trigger5_bench_show(struct seq_file *m, void *unused)
+{
+	struct drm_info_node *node = m->private;
+	struct trigger5_device *trigger5 = to_trigger5(node->minor->dev);
+	const char *name;
+	unsigned int i;
+	s64 ns;
+
+	seq_printf(m, "ns per call, best of %u\n", TRIGGER5_BENCH_RUNS);
+	for (i = 0;; i++) {
+		ns = trigger5_bench_run(i, &trigger5->mode_list, &name);
+		if (ns < 0)
+			break;
+		seq_printf(m, "%-14s %8lld\n", name, ns);
+	}
+	// Pixel conversion is timed per frame in convert_bench
+	return 0;
+}
@@ -0,0 +1,576 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <kunit/test.h>
+#include <linux/math.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/timekeeping.h>
+#include <linux/vmalloc.h>
+
+#include <asm/unaligned.h>
+
+#include <drm/drm_fourcc.h>
+#include <drm/drm_modes.h>
+
+#include "trigger5.h"
+
+/*
+ * KUnit tests of the pure compute paths: bulk header packing, mode lookup
+ * and SET_MODE packing, the PLL solver, pixel conversion and the cursor
+ * blend. None of them touch the device, so the suite runs under kunit.py on
+ * UML or QEMU. The bench case times the same units.
+ */
+
+static void trigger5_test_header_fields(struct kunit *test)
+{
+	struct trigger5_bulk_header header;
+	struct drm_rect rect = DRM_RECT_INIT(16, 32, 1920, 1080);
+	unsigned int i;
+	u8 sum = 0;
+
+	trigger5_fill_bulk_header(&header, 0x1234, &rect, 1920 * 1080 * 3);
+
+	KUNIT_EXPECT_EQ(test, header.magic, 0xfb);
+	KUNIT_EXPECT_EQ(test, header.length, 0x14);
+	// Only 12 bits of the counter are sent
+	KUNIT_EXPECT_EQ(test, le16_to_cpu(header.counter), 0x234);
+	KUNIT_EXPECT_EQ(test, le16_to_cpu(header.horizontal_offset), 16);
+	KUNIT_EXPECT_EQ(test, le16_to_cpu(header.vertical_offset), 32);
+	KUNIT_EXPECT_EQ(test, le16_to_cpu(header.width), 1920);
+	KUNIT_EXPECT_EQ(test, le16_to_cpu(header.height), 1080);
+	KUNIT_EXPECT_EQ(test, le32_to_cpu(header.payload_length),
+			1920 * 1080 * 3);
+	KUNIT_EXPECT_EQ(test, header.flags, 0x1);
+
+	for (i = 0; i < sizeof(header); i++)
+		sum += ((u8 *)&header)[i];
+	KUNIT_EXPECT_EQ(test, sum, 0);
+	KUNIT_EXPECT_EQ(test, trigger5_bulk_header_checksum(&header),
+			header.checksum);
+}
+
+static void trigger5_test_header_checksum(struct kunit *test)
+{
+	struct trigger5_bulk_header header;
+	struct drm_rect rect;
+	unsigned int i, j;
+	u8 sum;
+
+	for (i = 0; i < 256; i++) {
+		drm_rect_init(&rect, get_random_u32() % 4096,
+			      get_random_u32() % 4096,
+			      get_random_u32() % 4096 + 1,
+			      get_random_u32() % 4096 + 1);
+		trigger5_fill_bulk_header(&header, get_random_u32(), &rect,
+					  get_random_u32() & 0xfffffff);
+
+		for (j = 0, sum = 0; j < sizeof(header); j++)
+			sum += ((u8 *)&header)[j];
+		KUNIT_ASSERT_EQ_MSG(test, sum, 0, "header " DRM_RECT_FMT,
+				    DRM_RECT_ARG(&rect));
+	}
+}
+
+static void trigger5_test_fill_mode(struct trigger5_mode *trigger5_mode,
+				    const struct drm_display_mode *mode,
+				    u8 bpp, u8 mode_number)
+{
+	trigger5_mode->hz = drm_mode_vrefresh(mode);
+	trigger5_mode->bpp = bpp;
+	trigger5_mode->mode_number = mode_number;
+	trigger5_mode->width = cpu_to_le16(mode->hdisplay);
+	trigger5_mode->height = cpu_to_le16(mode->vdisplay);
+}
+
+// 1080p at both depths and 720p at 24 bpp only
+static void trigger5_test_mode_list(struct trigger5_mode_list *mode_list)
+{
+	const struct drm_display_mode *modes = trigger5_selftest_modes;
+
+	memset(mode_list, 0, sizeof(*mode_list));
+	mode_list->count = cpu_to_be16(3);
+	trigger5_test_fill_mode(&mode_list->modes[0], &modes[0], 32, 5);
+	trigger5_test_fill_mode(&mode_list->modes[1], &modes[0], 16, 6);
+	trigger5_test_fill_mode(&mode_list->modes[2], &modes[1], 32, 7);
+}
+
+static void trigger5_test_find_mode(struct kunit *test)
+{
+	const struct drm_display_mode *modes = trigger5_selftest_modes;
+	struct trigger5_mode_list mode_list;
+
+	trigger5_test_mode_list(&mode_list);
+
+	KUNIT_EXPECT_EQ(test, trigger5_find_mode(&mode_list, &modes[0], 24), 5);
+	KUNIT_EXPECT_EQ(test, trigger5_find_mode(&mode_list, &modes[0], 16), 6);
+	KUNIT_EXPECT_EQ(test, trigger5_find_mode(&mode_list, &modes[1], 24), 7);
+	// No 16 bpp variant, and the last mode catches anything at 24 bpp
+	KUNIT_EXPECT_EQ(test, trigger5_find_mode(&mode_list, &modes[1], 16),
+			-ENOENT);
+	KUNIT_EXPECT_EQ(test, trigger5_find_mode(&mode_list, &modes[2], 24), 7);
+}
+
+static void trigger5_test_mode_request(struct kunit *test)
+{
+	struct trigger6_mode_request request;
+
+	trigger5_fill_mode_request(&request, &trigger5_selftest_modes[0]);
+	KUNIT_EXPECT_EQ(test, be16_to_cpu(request.width), 1920);
+	KUNIT_EXPECT_EQ(test, be16_to_cpu(request.width_minus_one), 1919);
+	KUNIT_EXPECT_EQ(test, be16_to_cpu(request.height), 1080);
+	KUNIT_EXPECT_EQ(test, be16_to_cpu(request.height_minus_one), 1079);
+	KUNIT_EXPECT_EQ(test, be16_to_cpu(request.line_total_pixels), 2199);
+	KUNIT_EXPECT_EQ(test, be16_to_cpu(request.line_sync_pulse), 43);
+	KUNIT_EXPECT_EQ(test, be16_to_cpu(request.line_back_porch), 147);
+	KUNIT_EXPECT_EQ(test, be16_to_cpu(request.frame_total_lines), 1124);
+	KUNIT_EXPECT_EQ(test, be16_to_cpu(request.frame_sync_pulse), 4);
+	KUNIT_EXPECT_EQ(test, be16_to_cpu(request.frame_back_porch), 35);
+	KUNIT_EXPECT_EQ(test, request.hsync_polarity, 0);
+	KUNIT_EXPECT_EQ(test, request.vsync_polarity, 0);
+
+	trigger5_fill_mode_request(&request, &trigger5_selftest_modes[2]);
+	KUNIT_EXPECT_EQ(test, request.hsync_polarity, 1);
+	KUNIT_EXPECT_EQ(test, request.vsync_polarity, 1);
+}
+
+static void trigger5_test_pll_mode_status(struct kunit *test)
+{
+	// 10 ppm of slack, with the error in Hz against a clock in kHz
+	KUNIT_EXPECT_EQ(test, trigger5_pll_mode_status(1485, 148500), MODE_OK);
+	KUNIT_EXPECT_EQ(test, trigger5_pll_mode_status(1486, 148500),
+			MODE_CLOCK_RANGE);
+}
+
+// The exhaustive search the solver replaced, kept as its reference
+static u64 trigger5_test_brute_pll(struct trigger5_pll *pll, int clock)
+{
+	u64 target_clock = (u64)clock * 1000;
+	u64 calculated_clock, calculated_err, best_err = U64_MAX;
+	int prediv, mul1, mul2, div1, div2;
+
+	for (prediv = 1; prediv <= 0x10; prediv <<= 1) {
+		for (mul1 = 1; mul1 <= 0x32; mul1++) {
+			for (mul2 = 1; mul2 <= 0x32; mul2++) {
+				for (div1 = 1; div1 <= 0x32; div1++) {
+					for (div2 = 0x02; div2 <= 0x10;
+					     div2 <<= 1) {
+						calculated_clock =
+							10000000ULL * mul1 *
+							mul2 / prediv / div1 /
+							div2;
+						calculated_err =
+							abs_diff(calculated_clock,
+								 target_clock);
+						if (calculated_err >= best_err)
+							continue;
+						best_err = calculated_err;
+						pll->unknown = prediv;
+						pll->mul1 = mul1;
+						pll->mul2 = mul2;
+						pll->div1 = div1;
+						pll->div2 = div2;
+					}
+				}
+			}
+		}
+	}
+
+	return best_err;
+}
+
+static void trigger5_test_clock_desc(const int *clock, char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%d kHz", *clock);
+}
+
+KUNIT_ARRAY_PARAM(trigger5_test_clock, trigger5_selftest_clocks,
+		  trigger5_test_clock_desc);
+
+// Same error and the same registers as the brute-force search
+static void trigger5_test_pll(struct kunit *test)
+{
+	const int *clock = test->param_value;
+	struct trigger5_pll pll, ref;
+	u64 err, ref_err;
+
+	err = trigger5_calculate_pll(&pll, *clock);
+	ref_err = trigger5_test_brute_pll(&ref, *clock);
+
+	KUNIT_EXPECT_EQ(test, err, ref_err);
+	KUNIT_EXPECT_EQ(test, pll.unknown, ref.unknown);
+	KUNIT_EXPECT_EQ(test, pll.mul1, ref.mul1);
+	KUNIT_EXPECT_EQ(test, pll.mul2, ref.mul2);
+	KUNIT_EXPECT_EQ(test, pll.div1, ref.div1);
+	KUNIT_EXPECT_EQ(test, pll.div2, ref.div2);
+}
+
+// Every kernel this CPU can run, against the DRM helpers
+static void trigger5_test_convert(struct kunit *test)
+{
+	const struct trigger5_converter *converter;
+	unsigned int i;
+
+	for (i = 0;; i++) {
+		converter = trigger5_converter_get(i);
+		if (!converter)
+			break;
+		KUNIT_EXPECT_EQ_MSG(test, trigger5_convert_selftest(converter),
+				    0, "%s conversion", converter->name);
+	}
+	// The scalar converter at least
+	KUNIT_EXPECT_GT(test, i, 0);
+}
+
+// A device with only what conversion and the cursor blend look at
+static struct trigger5_device *trigger5_test_device(struct kunit *test,
+						   unsigned int wire_bpp)
+{
+	struct trigger5_device *trigger5;
+
+	trigger5 = kunit_kzalloc(test, sizeof(*trigger5), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, trigger5);
+	trigger5->wire_bpp = wire_bpp;
+	trigger5->converter = trigger5_converter_get(0);
+
+	return trigger5;
+}
+
+// Primaries, white and a mid grey widened by repeating the top bits
+static void trigger5_test_convert_rgb565(struct kunit *test)
+{
+	static const u16 in[] = { 0xffff, 0xf800, 0x07e0, 0x001f, 0x8410 };
+	static const u8 out[] = {
+		0xff, 0xff, 0xff, 0x00, 0x00, 0xff, 0x00, 0xff, 0x00,
+		0xff, 0x00, 0x00, 0x84, 0x82, 0x84,
+	};
+	const unsigned int width = ARRAY_SIZE(in);
+	struct drm_framebuffer fb = {
+		.format = drm_format_info(DRM_FORMAT_RGB565),
+		.pitches = { width * 2 },
+		.width = width,
+		.height = 1,
+	};
+	struct drm_rect rect = DRM_RECT_INIT(0, 0, width, 1);
+	struct trigger5_device *trigger5 = trigger5_test_device(test, 24);
+	struct iosys_map src_map, dst_map;
+	u8 src[ARRAY_SIZE(in) * 2], dst[ARRAY_SIZE(in) * 3];
+	unsigned int x;
+
+	for (x = 0; x < width; x++)
+		put_unaligned_le16(in[x], &src[x * 2]);
+	iosys_map_set_vaddr(&src_map, src);
+	iosys_map_set_vaddr(&dst_map, dst);
+
+	trigger5_convert_rect(trigger5, &dst_map, &src_map, &fb, &rect);
+	KUNIT_EXPECT_MEMEQ(test, dst, out, sizeof(out));
+
+	// Already the 16 bpp wire format
+	trigger5->wire_bpp = 16;
+	trigger5_convert_rect(trigger5, &dst_map, &src_map, &fb, &rect);
+	KUNIT_EXPECT_MEMEQ(test, dst, src, sizeof(src));
+}
+
+/*
+ * With dithering on, the default, a grey halfway between two 565 levels
+ * rounds up on exactly half of each 4x4 Bayer block, white does not
+ * overflow, and the pattern follows the screen position rather than the
+ * rectangle.
+ */
+static void trigger5_test_convert_dither(struct kunit *test)
+{
+	const unsigned int width = 8, height = 4;
+	struct drm_framebuffer fb = {
+		.format = drm_format_info(DRM_FORMAT_XRGB8888),
+		.pitches = { width * 4 },
+		.width = width,
+		.height = height,
+	};
+	struct drm_rect rect = DRM_RECT_INIT(0, 0, width, height);
+	struct trigger5_device *trigger5 = trigger5_test_device(test, 16);
+	struct iosys_map src_map, dst_map;
+	unsigned int x, y, r, g, b, pixel, up_r = 0, up_g = 0, up_b = 0;
+	u32 src[8 * 4];
+	u16 dst[8 * 4], part[7];
+
+	// 0x84 sits between 5 bit levels, 0x82 between 6 bit levels
+	for (x = 0; x < width * height; x++)
+		src[x] = 0x00848284;
+	src[width - 1] = 0x00ffffff;
+	iosys_map_set_vaddr(&src_map, src);
+	iosys_map_set_vaddr(&dst_map, dst);
+	trigger5_convert_rect(trigger5, &dst_map, &src_map, &fb, &rect);
+
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&dst[width - 1]), 0xffff);
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < 4; x++) {
+			pixel = get_unaligned_le16(&dst[y * width + x]);
+			r = pixel >> 11;
+			g = (pixel >> 5) & 0x3f;
+			b = pixel & 0x1f;
+			KUNIT_EXPECT_TRUE(test, r == 0x10 || r == 0x11);
+			KUNIT_EXPECT_TRUE(test, g == 0x20 || g == 0x21);
+			KUNIT_EXPECT_TRUE(test, b == 0x10 || b == 0x11);
+			up_r += r == 0x11;
+			up_g += g == 0x21;
+			up_b += b == 0x11;
+		}
+	}
+	KUNIT_EXPECT_EQ(test, up_r, 8);
+	KUNIT_EXPECT_EQ(test, up_g, 8);
+	KUNIT_EXPECT_EQ(test, up_b, 8);
+
+	// Converting from x = 1 on row 2 gives the same pixels
+	drm_rect_init(&rect, 1, 2, width - 1, 1);
+	iosys_map_set_vaddr(&dst_map, part);
+	trigger5_convert_rect(trigger5, &dst_map, &src_map, &fb, &rect);
+	KUNIT_EXPECT_MEMEQ(test, part, &dst[2 * width + 1], sizeof(part));
+}
+
+/*
+ * Stripes converted on the stripe workers match one pass on the calling
+ * thread, at odd sizes where the rows don't split evenly. trigger5_convert_rect
+ * picks its own stripe count from the CPUs online.
+ */
+static void trigger5_test_convert_stripes(struct kunit *test)
+{
+	const unsigned int width = 1031, height = 301;
+	struct drm_framebuffer fb = {
+		.format = drm_format_info(DRM_FORMAT_XRGB8888),
+		.pitches = { width * 4 },
+		.width = width,
+		.height = height,
+	};
+	struct drm_rect rect = DRM_RECT_INIT(3, 5, width - 3, height - 5);
+	struct trigger5_device *trigger5;
+	unsigned int bpp, len, i;
+	struct iosys_map src_map, dst_map;
+	u8 *src, *ref, *out;
+	const u8 *vaddr;
+
+	trigger5 = trigger5_test_device(test, 24);
+	src = kunit_kmalloc(test, width * height * 4, GFP_KERNEL);
+	ref = kunit_kmalloc(test, width * height * 3, GFP_KERNEL);
+	out = kunit_kmalloc(test, width * height * 3, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, src);
+	KUNIT_ASSERT_NOT_NULL(test, ref);
+	KUNIT_ASSERT_NOT_NULL(test, out);
+
+	for (i = 0; i < TRIGGER5_MAX_STRIPES - 1; i++) {
+		trigger5->stripe_workers[i] =
+			kthread_create_worker(0, "trigger5_test/%u", i);
+		if (IS_ERR(trigger5->stripe_workers[i]))
+			break;
+	}
+	trigger5->num_stripe_workers = i;
+	KUNIT_EXPECT_EQ(test, i, TRIGGER5_MAX_STRIPES - 1);
+
+	get_random_bytes(src, width * height * 4);
+	vaddr = src + rect.y1 * fb.pitches[0] + rect.x1 * 4;
+	iosys_map_set_vaddr(&src_map, src);
+	iosys_map_set_vaddr(&dst_map, out);
+
+	for (bpp = 16; bpp <= 24; bpp += 8) {
+		trigger5->wire_bpp = bpp;
+		len = drm_rect_width(&rect) * drm_rect_height(&rect) * bpp / 8;
+		trigger5_convert_stripes(trigger5, ref, vaddr, &fb, &rect, 1);
+
+		for (i = 2; i <= trigger5->num_stripe_workers + 1; i++) {
+			memset(out, 0, len);
+			trigger5_convert_stripes(trigger5, out, vaddr, &fb,
+						 &rect, i);
+			KUNIT_EXPECT_MEMEQ_MSG(test, out, ref, len,
+					       "%u stripes at %u bpp", i, bpp);
+		}
+
+		memset(out, 0, len);
+		trigger5_convert_rect(trigger5, &dst_map, &src_map, &fb, &rect);
+		KUNIT_EXPECT_MEMEQ_MSG(test, out, ref, len, "rect at %u bpp",
+				       bpp);
+	}
+
+	for (i = 0; i < trigger5->num_stripe_workers; i++)
+		kthread_destroy_worker(trigger5->stripe_workers[i]);
+}
+
+/*
+ * Opaque, transparent and half covered cursor pixels over a plain
+ * background, composed in one clip and again a row at a time.
+ */
+static void trigger5_test_cursor_blend(struct kunit *test)
+{
+	const unsigned int width = 6, height = 4;
+	struct drm_rect clip = DRM_RECT_INIT(0, 0, width, height);
+	struct trigger5_cursor_image *cursor;
+	struct trigger5_device *trigger5;
+	u8 dst[6 * 4 * 3], rows[6 * 4 * 3];
+	u8 *pixel;
+	unsigned int x, y;
+
+	trigger5 = trigger5_test_device(test, 24);
+	cursor = kunit_kzalloc(test, sizeof(*cursor), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, cursor);
+
+	// 2x2 at (2, 1): opaque red, clear, half white, clear
+	drm_rect_init(&cursor->rect, 2, 1, 2, 2);
+	cursor->visible = true;
+	cursor->data[0] = 0xffff0000;
+	cursor->data[TRIGGER5_CURSOR_SIZE] = 0x80808080;
+
+	// Wire RGB888 is stored B, G, R
+	for (x = 0; x < width * height; x++) {
+		dst[x * 3] = 0x10;
+		dst[x * 3 + 1] = 0x20;
+		dst[x * 3 + 2] = 0x30;
+	}
+	memcpy(rows, dst, sizeof(dst));
+
+	trigger5_cursor_compose(trigger5, cursor, dst, &clip);
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			pixel = &dst[(y * width + x) * 3];
+			if (x == 2 && y == 1) {
+				KUNIT_EXPECT_EQ(test, pixel[0], 0x00);
+				KUNIT_EXPECT_EQ(test, pixel[1], 0x00);
+				KUNIT_EXPECT_EQ(test, pixel[2], 0xff);
+			} else if (x == 2 && y == 2) {
+				// 0x80 plus the background at 127/255
+				KUNIT_EXPECT_EQ(test, pixel[0], 0x88);
+				KUNIT_EXPECT_EQ(test, pixel[1], 0x90);
+				KUNIT_EXPECT_EQ(test, pixel[2], 0x98);
+			} else {
+				KUNIT_EXPECT_EQ(test, pixel[0], 0x10);
+				KUNIT_EXPECT_EQ(test, pixel[1], 0x20);
+				KUNIT_EXPECT_EQ(test, pixel[2], 0x30);
+			}
+		}
+	}
+
+	for (y = 0; y < height; y++) {
+		drm_rect_init(&clip, 0, y, width, 1);
+		trigger5_cursor_compose(trigger5, cursor, &rows[y * width * 3],
+					&clip);
+	}
+	KUNIT_EXPECT_MEMEQ(test, rows, dst, sizeof(dst));
+
+	// At 16 bpp the opaque pixel is pure red and the clear one untouched
+	trigger5->wire_bpp = 16;
+	drm_rect_init(&clip, 2, 1, 2, 1);
+	put_unaligned_le16(0x1234, &dst[0]);
+	put_unaligned_le16(0x1234, &dst[2]);
+	trigger5_cursor_compose(trigger5, cursor, dst, &clip);
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&dst[0]), 0xf800);
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&dst[2]), 0x1234);
+
+	// A hidden cursor leaves everything alone
+	cursor->visible = false;
+	put_unaligned_le16(0x1234, &dst[0]);
+	trigger5_cursor_compose(trigger5, cursor, dst, &clip);
+	KUNIT_EXPECT_EQ(test, get_unaligned_le16(&dst[0]), 0x1234);
+}
+
+// Best of a few conversions of the whole framebuffer on one CPU, in ns
+static u64 trigger5_test_time_convert(struct trigger5_device *trigger5,
+				      struct iosys_map *dst,
+				      const struct iosys_map *src,
+				      const struct drm_framebuffer *fb)
+{
+	struct drm_rect rect = DRM_RECT_INIT(0, 0, fb->width, fb->height);
+	u64 start, best = U64_MAX;
+	unsigned int run;
+
+	for (run = 0; run < 8; run++) {
+		start = ktime_get_ns();
+		trigger5_convert_rect(trigger5, dst, src, fb, &rect);
+		best = min(best, ktime_get_ns() - start);
+		cond_resched();
+	}
+
+	return best;
+}
+
+static void trigger5_test_bench(struct kunit *test)
+{
+	struct drm_framebuffer fb = {
+		.format = drm_format_info(DRM_FORMAT_XRGB8888),
+		.pitches = { 1920 * 4 },
+		.width = 1920,
+		.height = 1080,
+	};
+	const struct trigger5_converter *converter;
+	struct trigger5_mode_list *mode_list;
+	struct trigger5_device *trigger5;
+	struct iosys_map src_map, dst_map;
+	const char *name;
+	unsigned int i;
+	u8 *src, *dst;
+	s64 ns;
+
+	mode_list = kunit_kmalloc(test, sizeof(*mode_list), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, mode_list);
+	trigger5_test_mode_list(mode_list);
+
+	for (i = 0;; i++) {
+		ns = trigger5_bench_run(i, mode_list, &name);
+		if (ns < 0)
+			break;
+		kunit_info(test, "%-14s %8lld ns per call\n", name, ns);
+	}
+
+	// Then a 1080p frame through each conversion path
+	trigger5 = trigger5_test_device(test, 24);
+	src = vmalloc(1920 * 1080 * 4);
+	dst = vmalloc(1920 * 1080 * 3);
+	if (!src || !dst) {
+		vfree(dst);
+		vfree(src);
+		KUNIT_FAIL(test, "no memory for the conversion bench");
+		return;
+	}
+	memset(src, 0x5a, 1920 * 1080 * 4);
+	iosys_map_set_vaddr(&src_map, src);
+	iosys_map_set_vaddr(&dst_map, dst);
+
+	for (i = 0; (converter = trigger5_converter_get(i)); i++) {
+		trigger5->converter = converter;
+		ns = trigger5_test_time_convert(trigger5, &dst_map, &src_map,
+						&fb);
+		kunit_info(test, "xrgb8888/%-5s %8lld ns per frame\n",
+			   converter->name, ns);
+	}
+
+	trigger5->wire_bpp = 16;
+	ns = trigger5_test_time_convert(trigger5, &dst_map, &src_map, &fb);
+	kunit_info(test, "xrgb8888/565   %8lld ns per frame\n", ns);
+
+	trigger5->wire_bpp = 24;
+	fb.format = drm_format_info(DRM_FORMAT_RGB565);
+	fb.pitches[0] = 1920 * 2;
+	ns = trigger5_test_time_convert(trigger5, &dst_map, &src_map, &fb);
+	kunit_info(test, "rgb565/888     %8lld ns per frame\n", ns);
+
+	vfree(dst);
+	vfree(src);
+}
+
+static struct kunit_case trigger5_test_cases[] = {
+	KUNIT_CASE(trigger5_test_header_fields),
+	KUNIT_CASE(trigger5_test_header_checksum),
+	KUNIT_CASE(trigger5_test_find_mode),
+	KUNIT_CASE(trigger5_test_mode_request),
+	KUNIT_CASE(trigger5_test_pll_mode_status),
+	KUNIT_CASE_PARAM(trigger5_test_pll, trigger5_test_clock_gen_params),
+	KUNIT_CASE(trigger5_test_convert),
+	KUNIT_CASE(trigger5_test_convert_rgb565),
+	KUNIT_CASE(trigger5_test_convert_dither),
+	KUNIT_CASE(trigger5_test_convert_stripes),
+	KUNIT_CASE(trigger5_test_cursor_blend),
+	KUNIT_CASE(trigger5_test_bench),
+	{}
+};
+
+static struct kunit_suite trigger5_test_suite = {
+	.name = "trigger5",
+	.test_cases = trigger5_test_cases,
+};
+
+kunit_test_suite(trigger5_test_suite);
@@ -0,0 +1,210 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+
+#if !defined(_TRIGGER5_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRIGGER5_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+#include <drm/drm_rect.h>
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM trigger5
+#define TRACE_INCLUDE_FILE trigger5_trace
+
+/*
+ * Every event carries the 12-bit counter of the frame's first bulk header,
+ * so one frame can be followed from damage to the wire.
+ */
+
+#ifndef _TRIGGER5_TRACE_STEPS_
+#define _TRIGGER5_TRACE_STEPS_
+enum trigger5_modeset_step {
+	TRIGGER5_MODESET_BEGIN,
+	TRIGGER5_MODESET_PLL,
+	TRIGGER5_MODESET_SET_MODE,
+	TRIGGER5_MODESET_DONE,
+};
+#endif
+
+TRACE_DEFINE_ENUM(TRIGGER5_MODESET_BEGIN);
+TRACE_DEFINE_ENUM(TRIGGER5_MODESET_PLL);
+TRACE_DEFINE_ENUM(TRIGGER5_MODESET_SET_MODE);
+TRACE_DEFINE_ENUM(TRIGGER5_MODESET_DONE);
+
+TRACE_EVENT(trigger5_damage,
+	TP_PROTO(u16 counter, const struct drm_rect *rect, unsigned int bytes),
+	TP_ARGS(counter, rect, bytes),
+	TP_STRUCT__entry(
+		__field(u16, counter)
+		__field(int, x1)
+		__field(int, y1)
+		__field(int, x2)
+		__field(int, y2)
+		__field(unsigned int, bytes)
+	),
+	TP_fast_assign(
+		__entry->counter = counter;
+		__entry->x1 = rect->x1;
+		__entry->y1 = rect->y1;
+		__entry->x2 = rect->x2;
+		__entry->y2 = rect->y2;
+		__entry->bytes = bytes;
+	),
+	TP_printk("counter=%u rect=%dx%d+%d+%d bytes=%u", __entry->counter,
+		  __entry->x2 - __entry->x1, __entry->y2 - __entry->y1,
+		  __entry->x1, __entry->y1, __entry->bytes)
+);
+
+TRACE_EVENT(trigger5_convert_begin,
+	TP_PROTO(u16 counter, unsigned int num_rects),
+	TP_ARGS(counter, num_rects),
+	TP_STRUCT__entry(
+		__field(u16, counter)
+		__field(unsigned int, num_rects)
+	),
+	TP_fast_assign(
+		__entry->counter = counter;
+		__entry->num_rects = num_rects;
+	),
+	TP_printk("counter=%u rects=%u", __entry->counter, __entry->num_rects)
+);
+
+TRACE_EVENT(trigger5_convert_end,
+	TP_PROTO(u16 counter, unsigned int len, bool zero_copy),
+	TP_ARGS(counter, len, zero_copy),
+	TP_STRUCT__entry(
+		__field(u16, counter)
+		__field(unsigned int, len)
+		__field(bool, zero_copy)
+	),
+	TP_fast_assign(
+		__entry->counter = counter;
+		__entry->len = len;
+		__entry->zero_copy = zero_copy;
+	),
+	TP_printk("counter=%u len=%u zero_copy=%d", __entry->counter,
+		  __entry->len, __entry->zero_copy)
+);
+
+TRACE_EVENT(trigger5_buffer_alloc,
+	TP_PROTO(u16 counter, unsigned int len, unsigned int size, bool reused),
+	TP_ARGS(counter, len, size, reused),
+	TP_STRUCT__entry(
+		__field(u16, counter)
+		__field(unsigned int, len)
+		__field(unsigned int, size)
+		__field(bool, reused)
+	),
+	TP_fast_assign(
+		__entry->counter = counter;
+		__entry->len = len;
+		__entry->size = size;
+		__entry->reused = reused;
+	),
+	TP_printk("counter=%u len=%u size=%u reused=%d", __entry->counter,
+		  __entry->len, __entry->size, __entry->reused)
+);
+
+TRACE_EVENT(trigger5_urb_submit,
+	TP_PROTO(u16 counter, unsigned int urb, unsigned int offset,
+		 unsigned int len),
+	TP_ARGS(counter, urb, offset, len),
+	TP_STRUCT__entry(
+		__field(u16, counter)
+		__field(unsigned int, urb)
+		__field(unsigned int, offset)
+		__field(unsigned int, len)
+	),
+	TP_fast_assign(
+		__entry->counter = counter;
+		__entry->urb = urb;
+		__entry->offset = offset;
+		__entry->len = len;
+	),
+	TP_printk("counter=%u urb=%u offset=%u len=%u", __entry->counter,
+		  __entry->urb, __entry->offset, __entry->len)
+);
+
+TRACE_EVENT(trigger5_urb_complete,
+	TP_PROTO(u16 counter, unsigned int urb, int status,
+		 unsigned int actual_length),
+	TP_ARGS(counter, urb, status, actual_length),
+	TP_STRUCT__entry(
+		__field(u16, counter)
+		__field(unsigned int, urb)
+		__field(int, status)
+		__field(unsigned int, actual_length)
+	),
+	TP_fast_assign(
+		__entry->counter = counter;
+		__entry->urb = urb;
+		__entry->status = status;
+		__entry->actual_length = actual_length;
+	),
+	TP_printk("counter=%u urb=%u status=%d actual=%u", __entry->counter,
+		  __entry->urb, __entry->status, __entry->actual_length)
+);
+
+TRACE_EVENT(trigger5_urb_timeout,
+	TP_PROTO(u16 counter, unsigned int urb),
+	TP_ARGS(counter, urb),
+	TP_STRUCT__entry(
+		__field(u16, counter)
+		__field(unsigned int, urb)
+	),
+	TP_fast_assign(
+		__entry->counter = counter;
+		__entry->urb = urb;
+	),
+	TP_printk("counter=%u urb=%u", __entry->counter, __entry->urb)
+);
+
+TRACE_EVENT(trigger5_frame_done,
+	TP_PROTO(u16 counter, unsigned int len, bool timed_out),
+	TP_ARGS(counter, len, timed_out),
+	TP_STRUCT__entry(
+		__field(u16, counter)
+		__field(unsigned int, len)
+		__field(bool, timed_out)
+	),
+	TP_fast_assign(
+		__entry->counter = counter;
+		__entry->len = len;
+		__entry->timed_out = timed_out;
+	),
+	TP_printk("counter=%u len=%u timed_out=%d", __entry->counter,
+		  __entry->len, __entry->timed_out)
+);
+
+TRACE_EVENT(trigger5_modeset,
+	TP_PROTO(u16 counter, enum trigger5_modeset_step step, int mode_number,
+		 int clock),
+	TP_ARGS(counter, step, mode_number, clock),
+	TP_STRUCT__entry(
+		__field(u16, counter)
+		__field(enum trigger5_modeset_step, step)
+		__field(int, mode_number)
+		__field(int, clock)
+	),
+	TP_fast_assign(
+		__entry->counter = counter;
+		__entry->step = step;
+		__entry->mode_number = mode_number;
+		__entry->clock = clock;
+	),
+	TP_printk("counter=%u step=%s mode=%d clock=%d", __entry->counter,
+		  __print_symbolic(__entry->step,
+				   { TRIGGER5_MODESET_BEGIN, "begin" },
+				   { TRIGGER5_MODESET_PLL, "pll" },
+				   { TRIGGER5_MODESET_SET_MODE, "set_mode" },
+				   { TRIGGER5_MODESET_DONE, "done" }),
+		  __entry->mode_number, __entry->clock)
+);
+
+#endif /* _TRIGGER5_TRACE_H_ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#include <trace/define_trace.h>
@@ -0,0 +1,694 @@
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/timekeeping.h>
+#include <linux/vmalloc.h>
+
+#include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/drm_gem_shmem_helper.h>
+#include <drm/drm_managed.h>
+#include <drm/drm_print.h>
+#include <drm/drm_vblank.h>
+
+#include "trigger5.h"
+#include "trigger5_trace.h"
+
+static unsigned int urb_count = 4;
+module_param(urb_count, uint, 0444);
+MODULE_PARM_DESC(urb_count, "Number of bulk URBs kept in flight (1-32, default 4)");
+
+static unsigned int urb_size = SZ_256K;
+module_param(urb_size, uint, 0444);
+MODULE_PARM_DESC(urb_size, "Bytes per bulk URB, rounded to pages (default 262144)");
+
+static bool worker_fifo;
+module_param(worker_fifo, bool, 0444);
+MODULE_PARM_DESC(worker_fifo, "Run each device's frame and stripe workers as SCHED_FIFO (default false)");
+
+#define TRIGGER5_MAX_URBS	32
+#define TRIGGER5_URB_TIMEOUT_MS	5000
+
+// Largest block tried for the bulk buffers, 64 KiB with 4 KiB pages
+#define TRIGGER5_BUFFER_MAX_ORDER	4
+
+void trigger5_free_bulk_buffer(struct trigger5_frame *frame)
+{
+	unsigned int i;
+
+	if (!frame->data)
+		return;
+	sg_free_table(&frame->sgt);
+	vunmap(frame->data);
+	for (i = 0; i < frame->size >> PAGE_SHIFT; i++)
+		__free_page(frame->pages[i]);
+	kvfree(frame->pages);
+	frame->pages = NULL;
+	frame->data = NULL;
+	frame->size = 0;
+}
+
+/*
+ * The buffer is allocated once, at the size of the largest mode, and every
+ * frame uses a prefix of it. It is built from the highest order blocks
+ * available so the scatterlist has few entries, and mapped contiguously for
+ * the CPU.
+ */
+int trigger5_alloc_bulk_buffer(struct trigger5_device *trigger5,
+			       struct trigger5_frame *frame, unsigned int len)
+{
+	unsigned int size = PAGE_ALIGN(trigger5->max_frame_len);
+	unsigned int num_pages = size >> PAGE_SHIFT;
+	unsigned int i = 0, j, order;
+	struct page **pages;
+	struct page *page;
+	int ret;
+
+	if (len > size)
+		return -E2BIG;
+
+	trace_trigger5_buffer_alloc(frame->counter, len, size, !!frame->data);
+	if (frame->data) {
+		atomic64_inc(&trigger5->stats.buffer_allocs_avoided);
+		return 0;
+	}
+
+	pages = kvmalloc_array(num_pages, sizeof(struct page *), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	while (i < num_pages) {
+		order = min_t(unsigned int, TRIGGER5_BUFFER_MAX_ORDER,
+			      ilog2(num_pages - i));
+		for (page = NULL; !page && order; order--)
+			page = alloc_pages(GFP_KERNEL | __GFP_DMA32 |
+						   __GFP_NOWARN | __GFP_NORETRY,
+					   order);
+		if (page)
+			order++;
+		else
+			page = alloc_page(GFP_KERNEL | __GFP_DMA32);
+		if (!page) {
+			ret = -ENOMEM;
+			goto err_free_pages;
+		}
+
+		// Split so the pages can be mapped and freed one by one
+		split_page(page, order);
+		for (j = 0; j < 1 << order; j++)
+			pages[i++] = nth_page(page, j);
+	}
+
+	frame->data = vmap(pages, num_pages, VM_MAP, PAGE_KERNEL);
+	if (!frame->data) {
+		ret = -ENOMEM;
+		goto err_free_pages;
+	}
+
+	ret = sg_alloc_table_from_pages(&frame->sgt, pages, num_pages, 0, size,
+					GFP_KERNEL);
+	if (ret) {
+		vunmap(frame->data);
+		frame->data = NULL;
+		goto err_free_pages;
+	}
+
+	frame->pages = pages;
+	frame->size = size;
+	atomic64_inc(&trigger5->stats.buffer_allocs);
+
+	return 0;
+
+err_free_pages:
+	while (i--)
+		__free_page(pages[i]);
+	kvfree(pages);
+	return ret;
+}
+
+// Drop the framebuffer pinned by the last zero-copy transfer of this buffer
+void trigger5_release_framebuffer(struct trigger5_frame *frame)
+{
+	if (!frame->shmem)
+		return;
+	sg_free_table(&frame->zc_sgt);
+	drm_gem_shmem_unpin(frame->shmem);
+	drm_gem_object_put(&frame->shmem->base);
+	frame->shmem = NULL;
+}
+
+/*
+ * Describe the header and the framebuffer rows of a full-width RGB888
+ * update in one scatterlist, so the pixels go to the device straight from
+ * the GEM pages. Returns the transfer length.
+ */
+int trigger5_map_framebuffer(struct trigger5_frame *frame,
+			     struct drm_framebuffer *fb,
+			     const struct drm_rect *rect)
+{
+	struct drm_gem_object *obj = drm_gem_fb_get_obj(fb, 0);
+	struct drm_gem_shmem_object *shmem = to_drm_gem_shmem_obj(obj);
+	unsigned int start = fb->offsets[0] + rect->y1 * fb->pitches[0];
+	unsigned int bytes = drm_rect_height(rect) * fb->pitches[0];
+	unsigned int offset = offset_in_page(start);
+	unsigned int num_pages = DIV_ROUND_UP(offset + bytes, PAGE_SIZE);
+	struct page **pages;
+	struct scatterlist *sg;
+	unsigned int i, len;
+	int ret;
+
+	ret = drm_gem_shmem_pin(shmem);
+	if (ret)
+		return ret;
+
+	ret = sg_alloc_table(&frame->zc_sgt, num_pages + 1, GFP_KERNEL);
+	if (ret) {
+		drm_gem_shmem_unpin(shmem);
+		return ret;
+	}
+
+	drm_gem_object_get(obj);
+	frame->shmem = shmem;
+
+	sg = frame->zc_sgt.sgl;
+	sg_set_buf(sg, frame->header, sizeof(*frame->header));
+	pages = shmem->pages + (start >> PAGE_SHIFT);
+	for (i = 0; i < num_pages; i++) {
+		sg = sg_next(sg);
+		len = min_t(unsigned int, bytes, PAGE_SIZE - offset);
+		sg_set_page(sg, pages[i], len, offset);
+		bytes -= len;
+		offset = 0;
+	}
+
+	return sizeof(*frame->header) + drm_rect_height(rect) * fb->pitches[0];
+}
+
+// Complete the flip that produced the frame now that it left the ring
+static void trigger5_send_event_locked(struct trigger5_device *trigger5,
+				       struct trigger5_frame *frame)
+{
+	if (!frame->event)
+		return;
+
+	spin_lock(&trigger5->drm.event_lock);
+	drm_crtc_send_vblank_event(&trigger5->display_pipe.crtc, frame->event);
+	spin_unlock(&trigger5->drm.event_lock);
+	frame->event = NULL;
+}
+
+static void trigger5_frame_done_locked(struct trigger5_device *trigger5,
+				       struct trigger5_frame *frame)
+{
+	struct trigger5_rate *rate = &trigger5->rate;
+	u64 now = ktime_get_ns();
+
+	trigger5->queued--;
+	atomic64_inc(&trigger5->stats.frames_transferred);
+	if (frame->timed_out)
+		atomic64_inc(&trigger5->stats.frames_timed_out);
+	trigger5_hist_add(&trigger5->stats.transfer_time,
+			  now - frame->submit_time);
+	trigger5_hist_add(&trigger5->stats.latency, now - frame->commit_time);
+	trace_trigger5_frame_done(frame->counter, frame->len, frame->timed_out);
+	trigger5_send_event_locked(trigger5, frame);
+
+	if (!trigger5->boot.first_frame) {
+		WRITE_ONCE(trigger5->boot.first_frame,
+			   now - trigger5->boot.start);
+		drm_info(&trigger5->drm, "first frame %llu ms after probe\n",
+			 div_u64(trigger5->boot.first_frame, NSEC_PER_MSEC));
+	}
+
+	// Roll the throughput window about once a second
+	rate->frames++;
+	rate->bytes += frame->len;
+	rate->busy += now - max(frame->submit_time, rate->last_done);
+	rate->last_done = now;
+	if (now - rate->start >= NSEC_PER_SEC) {
+		rate->window = now - rate->start;
+		trigger5_quality_update_locked(trigger5);
+		rate->last_frames = rate->frames;
+		rate->last_bytes = rate->bytes;
+		rate->start = now;
+		rate->frames = 0;
+		rate->bytes = 0;
+		rate->busy = 0;
+		rate->coalesced = 0;
+	}
+
+	complete(&frame->complete);
+}
+
+/*
+ * Describe the next chunk of the frame in the URB's own scatterlist. Hosts
+ * without sg support get a single page per URB instead.
+ */
+static unsigned int trigger5_map_chunk(struct trigger5_device *trigger5,
+				       struct trigger5_frame *frame,
+				       struct trigger5_urb *turb)
+{
+	unsigned int remaining =
+		min(trigger5->urb_size, frame->ready - frame->submitted);
+	unsigned int nents = 0, chunk = 0, offset, len;
+	struct scatterlist *sg;
+
+	sg_init_table(turb->sg, trigger5->urb_max_sgs);
+	while (remaining && nents < trigger5->urb_max_sgs) {
+		sg = frame->cursor;
+		offset = sg->offset + frame->cursor_offset;
+		len = min(remaining, sg->length - frame->cursor_offset);
+		if (!trigger5->urb_sg)
+			len = min_t(unsigned int, len,
+				    PAGE_SIZE - offset_in_page(offset));
+		sg_set_page(&turb->sg[nents++],
+			    nth_page(sg_page(sg), offset >> PAGE_SHIFT), len,
+			    offset_in_page(offset));
+
+		remaining -= len;
+		chunk += len;
+		frame->cursor_offset += len;
+		if (frame->cursor_offset == sg->length) {
+			frame->cursor = sg_next(sg);
+			frame->cursor_offset = 0;
+		}
+	}
+	sg_mark_end(&turb->sg[nents - 1]);
+
+	if (trigger5->urb_sg) {
+		turb->urb->sg = turb->sg;
+		turb->urb->num_sgs = nents;
+		turb->urb->transfer_buffer = NULL;
+	} else {
+		turb->urb->sg = NULL;
+		turb->urb->num_sgs = 0;
+		turb->urb->transfer_buffer = sg_virt(turb->sg);
+	}
+	turb->urb->transfer_buffer_length = chunk;
+
+	return chunk;
+}
+
+/*
+ * Keep every idle URB busy with the next chunk of the oldest queued frame.
+ * Called from the update worker and from URB completion, so the bus is fed
+ * back to back without a worker in between.
+ */
+static void trigger5_submit_urbs_locked(struct trigger5_device *trigger5)
+{
+	struct trigger5_frame *frame;
+	struct trigger5_urb *turb;
+	unsigned int index, chunk;
+	int ret;
+
+	while (!trigger5->stopped && trigger5->to_submit &&
+	       trigger5->idle_urbs) {
+		frame = &trigger5->frames[trigger5->transfer_index];
+
+		// Only the end of a frame may go out as a short URB
+		if (frame->ready != frame->len &&
+		    frame->ready - frame->submitted < trigger5->urb_size)
+			break;
+
+		index = __ffs(trigger5->idle_urbs);
+		turb = &trigger5->urbs[index];
+
+		if (!frame->submitted)
+			frame->submit_time = ktime_get_ns();
+		chunk = trigger5_map_chunk(trigger5, frame, turb);
+		trace_trigger5_urb_submit(frame->counter, index,
+					  frame->submitted, chunk);
+		frame->submitted += chunk;
+		if (frame->submitted == frame->len) {
+			trigger5->transfer_index = (trigger5->transfer_index + 1) %
+						   TRIGGER5_NUM_FRAMES;
+			trigger5->to_submit--;
+		}
+
+		turb->frame = frame;
+		turb->timed_out = false;
+		usb_anchor_urb(turb->urb, &trigger5->anchor);
+		ret = usb_submit_urb(turb->urb, GFP_ATOMIC);
+		if (ret) {
+			usb_unanchor_urb(turb->urb);
+			atomic64_inc(&trigger5->stats.urb_errors);
+			drm_dbg(&trigger5->drm, "bulk submit failed: %d\n", ret);
+
+			// The device resyncs on the next header, drop the rest
+			if (frame->submitted != frame->len) {
+				frame->submitted = frame->len;
+				frame->ready = frame->len;
+				trigger5->transfer_index =
+					(trigger5->transfer_index + 1) %
+					TRIGGER5_NUM_FRAMES;
+				trigger5->to_submit--;
+			}
+			if (!frame->in_flight)
+				trigger5_frame_done_locked(trigger5, frame);
+			// The URB is still idle, try it on the next frame
+			continue;
+		}
+
+		__clear_bit(index, &trigger5->idle_urbs);
+		frame->in_flight++;
+		mod_timer(&turb->timer,
+			  jiffies + msecs_to_jiffies(TRIGGER5_URB_TIMEOUT_MS));
+	}
+}
+
+static void trigger5_urb_complete(struct urb *urb)
+{
+	struct trigger5_urb *turb = urb->context;
+	struct trigger5_device *trigger5 = turb->trigger5;
+	struct trigger5_frame *frame = turb->frame;
+	unsigned long flags;
+
+	del_timer(&turb->timer);
+	trace_trigger5_urb_complete(frame->counter, turb - trigger5->urbs,
+				    urb->status, urb->actual_length);
+
+	if (urb->status && urb->status != -ENOENT &&
+	    urb->status != -ECONNRESET && urb->status != -ESHUTDOWN)
+		atomic64_inc(&trigger5->stats.urb_errors);
+	atomic64_add(urb->actual_length, &trigger5->stats.bytes_sent);
+
+	spin_lock_irqsave(&trigger5->queue_lock, flags);
+	turb->frame = NULL;
+	if (turb->timed_out) {
+		frame->timed_out = true;
+		turb->timed_out = false;
+	}
+	if (!turb->unlinking)
+		__set_bit(turb - trigger5->urbs, &trigger5->idle_urbs);
+	frame->in_flight--;
+	if (frame->submitted == frame->len && !frame->in_flight)
+		trigger5_frame_done_locked(trigger5, frame);
+	trigger5_submit_urbs_locked(trigger5);
+	spin_unlock_irqrestore(&trigger5->queue_lock, flags);
+}
+
+/*
+ * The URB may have completed and gone out again for the next frame while
+ * the timer fired, in which case the timer is armed again and this run is
+ * stale. Otherwise keep the URB from being reused until the unlink, which
+ * must not hold queue_lock, is done.
+ */
+static void trigger5_urb_timeout(struct timer_list *t)
+{
+	struct trigger5_urb *turb = from_timer(turb, t, timer);
+	struct trigger5_device *trigger5 = turb->trigger5;
+	struct trigger5_frame *frame;
+	unsigned long flags;
+
+	spin_lock_irqsave(&trigger5->queue_lock, flags);
+	frame = turb->frame;
+	if (frame && !timer_pending(&turb->timer)) {
+		turb->timed_out = true;
+		turb->unlinking = true;
+	} else {
+		frame = NULL;
+	}
+	spin_unlock_irqrestore(&trigger5->queue_lock, flags);
+	if (!frame)
+		return;
+
+	trace_trigger5_urb_timeout(frame->counter, turb - trigger5->urbs);
+	atomic64_inc(&trigger5->stats.urb_timeouts);
+	usb_unlink_urb(turb->urb);
+
+	spin_lock_irqsave(&trigger5->queue_lock, flags);
+	turb->unlinking = false;
+	if (!turb->frame) {
+		// Completed during the unlink, hand it back now
+		__set_bit(turb - trigger5->urbs, &trigger5->idle_urbs);
+		trigger5_submit_urbs_locked(trigger5);
+	}
+	spin_unlock_irqrestore(&trigger5->queue_lock, flags);
+}
+
+/*
+ * Queue the frame being filled before its content is ready. URBs go out as
+ * trigger5_frame_ready reports converted data, so the transfer overlaps the
+ * conversion of the rest of the frame. The flip event, if any, completes
+ * once the frame is on the wire.
+ */
+struct trigger5_frame *
+trigger5_begin_frame(struct trigger5_device *trigger5, struct sg_table *sgt,
+		     unsigned int len, struct drm_pending_vblank_event *event)
+{
+	struct trigger5_frame *frame = &trigger5->frames[trigger5->fill_index];
+	unsigned long flags;
+
+	frame->len = len;
+	frame->ready = 0;
+	frame->submitted = 0;
+	frame->in_flight = 0;
+	frame->timed_out = false;
+	frame->cursor = sgt->sgl;
+	frame->cursor_offset = 0;
+	frame->event = event;
+
+	spin_lock_irqsave(&trigger5->queue_lock, flags);
+	trigger5->fill_index = (trigger5->fill_index + 1) % TRIGGER5_NUM_FRAMES;
+	trigger5->queued++;
+	trigger5->to_submit++;
+	spin_unlock_irqrestore(&trigger5->queue_lock, flags);
+
+	atomic64_inc(&trigger5->stats.frames_queued);
+	return frame;
+}
+
+// The first ready bytes of the frame are filled in and may be sent
+void trigger5_frame_ready(struct trigger5_device *trigger5,
+			  struct trigger5_frame *frame, unsigned int ready)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&trigger5->queue_lock, flags);
+	// A failed submission may already have written the frame off
+	frame->ready = max(frame->ready, ready);
+	trigger5_submit_urbs_locked(trigger5);
+	spin_unlock_irqrestore(&trigger5->queue_lock, flags);
+}
+
+void trigger5_queue_frame(struct trigger5_device *trigger5,
+			  struct sg_table *sgt, unsigned int len,
+			  struct drm_pending_vblank_event *event)
+{
+	struct trigger5_frame *frame =
+		trigger5_begin_frame(trigger5, sgt, len, event);
+
+	trigger5_frame_ready(trigger5, frame, len);
+}
+
+/*
+ * Take back the newest queued frame if none of it has gone out yet, so a
+ * commit can replace its content instead of waiting for a free buffer.
+ */
+struct trigger5_frame *trigger5_reclaim_frame(struct trigger5_device *trigger5)
+{
+	struct trigger5_frame *frame = NULL;
+	unsigned long flags;
+	unsigned int index;
+
+	spin_lock_irqsave(&trigger5->queue_lock, flags);
+	index = (trigger5->fill_index + TRIGGER5_NUM_FRAMES - 1) %
+		TRIGGER5_NUM_FRAMES;
+	if (!trigger5->stopped && trigger5->to_submit &&
+	    !trigger5->frames[index].submitted) {
+		frame = &trigger5->frames[index];
+		trigger5->fill_index = index;
+		trigger5->queued--;
+		trigger5->to_submit--;
+		trigger5->rate.coalesced++;
+		// Its content is superseded, so is the flip that produced it
+		trigger5_send_event_locked(trigger5, frame);
+	}
+	spin_unlock_irqrestore(&trigger5->queue_lock, flags);
+
+	return frame;
+}
+
+/*
+ * Thread 0 runs the updates, the others convert stripes of large
+ * rectangles.
+ */
+static struct kthread_worker *
+trigger5_create_worker(struct trigger5_device *trigger5, unsigned int index)
+{
+	const char *name = dev_name(&trigger5->intf->dev);
+	struct kthread_worker *worker;
+
+	if (index)
+		worker = kthread_create_worker(0, "trigger5/%s:%u", name,
+					       index);
+	else
+		worker = kthread_create_worker(0, "trigger5/%s", name);
+	if (!IS_ERR(worker) && worker_fifo)
+		sched_set_fifo(worker->task);
+
+	return worker;
+}
+
+static void trigger5_transfer_release(struct drm_device *dev, void *res)
+{
+	struct trigger5_device *trigger5 = to_trigger5(dev);
+	unsigned int i;
+
+	if (trigger5->worker) {
+		// Queues the worker, and is only queued while enabled
+		cancel_work_sync(&trigger5->depth_work);
+		kthread_destroy_worker(trigger5->worker);
+		trigger5_release_update(trigger5);
+	}
+	// After the frame worker, which hands stripes to these
+	for (i = 0; i < trigger5->num_stripe_workers; i++)
+		kthread_destroy_worker(trigger5->stripe_workers[i]);
+	trigger5->num_stripe_workers = 0;
+
+	for (i = 0; i < trigger5->num_urbs; i++) {
+		usb_free_urb(trigger5->urbs[i].urb);
+		kfree(trigger5->urbs[i].sg);
+	}
+	kfree(trigger5->urbs);
+
+	for (i = 0; i < TRIGGER5_NUM_FRAMES; i++) {
+		trigger5_release_framebuffer(&trigger5->frames[i]);
+		trigger5_free_bulk_buffer(&trigger5->frames[i]);
+		kfree(trigger5->frames[i].header);
+	}
+}
+
+int trigger5_transfer_init(struct trigger5_device *trigger5)
+{
+	struct usb_device *udev = interface_to_usbdev(trigger5->intf);
+	struct kthread_worker *worker;
+	struct trigger5_urb *turb;
+	unsigned int i, pages, workers;
+	int ret;
+
+	spin_lock_init(&trigger5->queue_lock);
+	init_usb_anchor(&trigger5->anchor);
+	trigger5->rate.start = ktime_get_ns();
+	for (i = 0; i < TRIGGER5_NUM_FRAMES; i++) {
+		trigger5->frames[i].size = 0;
+		init_completion(&trigger5->frames[i].complete);
+		complete(&trigger5->frames[i].complete);
+	}
+
+	trigger5->num_urbs =
+		clamp_t(unsigned int, urb_count, 1, TRIGGER5_MAX_URBS);
+	trigger5->urb_size = round_up(
+		clamp_t(unsigned int, urb_size, PAGE_SIZE, SZ_16M), PAGE_SIZE);
+
+	/*
+	 * Only the last URB of a frame may be short, anything else ends the
+	 * transfer early on the device. Leave room for a zero-copy header and
+	 * a partial first page besides the full pages, and shrink the URBs to
+	 * what the host can describe. Hosts without sg support get one page
+	 * per URB.
+	 */
+	trigger5->urb_sg = udev->bus->sg_tablesize > 2;
+	trigger5->urb_max_sgs = 1;
+	if (trigger5->urb_sg) {
+		pages = min(trigger5->urb_size >> PAGE_SHIFT,
+			    udev->bus->sg_tablesize - 2);
+		trigger5->urb_size = pages << PAGE_SHIFT;
+		trigger5->urb_max_sgs = pages + 2;
+	}
+
+	// Zero-copy transfers need a header entry shorter than a packet
+	trigger5->zero_copy = trigger5->urb_sg && udev->bus->no_sg_constraint;
+
+	/*
+	 * Updates are converted on threads owned by this adapter, one for
+	 * each update and a few more for the stripes of large rectangles, so
+	 * hosts driving several displays can pin each one to its own CPUs
+	 * through the worker_cpus attribute.
+	 */
+	trigger5->worker = trigger5_create_worker(trigger5, 0);
+	if (IS_ERR(trigger5->worker)) {
+		ret = PTR_ERR(trigger5->worker);
+		trigger5->worker = NULL;
+		return ret;
+	}
+
+	workers = min_t(unsigned int, num_possible_cpus(),
+			TRIGGER5_MAX_STRIPES);
+	for (i = 1; i < workers; i++) {
+		worker = trigger5_create_worker(trigger5, i);
+		if (IS_ERR(worker)) {
+			trigger5_transfer_release(&trigger5->drm, NULL);
+			return PTR_ERR(worker);
+		}
+		trigger5->stripe_workers[trigger5->num_stripe_workers++] =
+			worker;
+	}
+
+	trigger5->urbs = kcalloc(trigger5->num_urbs, sizeof(*trigger5->urbs),
+				 GFP_KERNEL);
+	if (!trigger5->urbs) {
+		trigger5->num_urbs = 0;
+		trigger5_transfer_release(&trigger5->drm, NULL);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < TRIGGER5_NUM_FRAMES; i++) {
+		trigger5->frames[i].header = kmalloc(
+			sizeof(*trigger5->frames[i].header), GFP_KERNEL);
+		if (!trigger5->frames[i].header) {
+			trigger5_transfer_release(&trigger5->drm, NULL);
+			return -ENOMEM;
+		}
+	}
+
+	for (i = 0; i < trigger5->num_urbs; i++) {
+		turb = &trigger5->urbs[i];
+		turb->trigger5 = trigger5;
+		timer_setup(&turb->timer, trigger5_urb_timeout, 0);
+
+		turb->urb = usb_alloc_urb(0, GFP_KERNEL);
+		turb->sg = kmalloc_array(trigger5->urb_max_sgs,
+					 sizeof(*turb->sg), GFP_KERNEL);
+		if (!turb->urb || !turb->sg) {
+			trigger5->num_urbs = i + 1;
+			trigger5_transfer_release(&trigger5->drm, NULL);
+			return -ENOMEM;
+		}
+		usb_fill_bulk_urb(turb->urb, udev, usb_sndbulkpipe(udev, 0x01),
+				  NULL, 0, trigger5_urb_complete, turb);
+		__set_bit(i, &trigger5->idle_urbs);
+	}
+
+	return drmm_add_action_or_reset(&trigger5->drm,
+					trigger5_transfer_release, NULL);
+}
+
+void trigger5_transfer_stop(struct trigger5_device *trigger5)
+{
+	struct trigger5_frame *frame;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&trigger5->queue_lock, flags);
+	trigger5->stopped = true;
+	spin_unlock_irqrestore(&trigger5->queue_lock, flags);
+
+	usb_kill_anchored_urbs(&trigger5->anchor);
+	for (i = 0; i < trigger5->num_urbs; i++)
+		del_timer_sync(&trigger5->urbs[i].timer);
+
+	// Release frames that never made it onto the bus
+	spin_lock_irqsave(&trigger5->queue_lock, flags);
+	while (trigger5->to_submit) {
+		frame = &trigger5->frames[trigger5->transfer_index];
+		trigger5->transfer_index =
+			(trigger5->transfer_index + 1) % TRIGGER5_NUM_FRAMES;
+		trigger5->to_submit--;
+		trigger5->queued--;
+		trigger5_send_event_locked(trigger5, frame);
+		complete(&frame->complete);
+	}
+	spin_unlock_irqrestore(&trigger5->queue_lock, flags);
+}